@@ -35,16 +35,10 @@ Version History:
 
 #include "adcpiv3.h"
 
-const float varDivisior = 64;
-float varMultiplier = 0;
-
 int main1(int argc, char **argv) {
   int i, j;
   float val;
   int channel;
-  // setup multiplier based on input voltage range and divisor value
-  varMultiplier = (1 / varDivisior) / 1000;
-  // 2.4705882 constant in place of 1 (not neccessary)
 
   if (argc > 1) channel = atoi(argv[1]);
   if (channel < 1 | channel > 8) channel = 1;
@@ -72,45 +66,282 @@ int main1(int argc, char **argv) {
   return 0;
 }
 
-float getadc (int chn) {
-  unsigned int fh, dummy, adc, adc_channel;
-  float val;
-  __u8  res[4];
-  // select chip and channel from args
-  switch (chn) {
-  case 1: { adc = ADC_1; adc_channel = ADC_CHANNEL1; }; break;
-  case 2: { adc = ADC_1; adc_channel = ADC_CHANNEL2; }; break;
-  case 3: { adc = ADC_1; adc_channel = ADC_CHANNEL3; }; break;
-  case 4: { adc = ADC_1; adc_channel = ADC_CHANNEL4; }; break;
-  case 5: { adc = ADC_2; adc_channel = ADC_CHANNEL1; }; break;
-  case 6: { adc = ADC_2; adc_channel = ADC_CHANNEL2; }; break;
-  case 7: { adc = ADC_2; adc_channel = ADC_CHANNEL3; }; break;
-  case 8: { adc = ADC_2; adc_channel = ADC_CHANNEL4; }; break;
-  default: { adc = ADC_1; adc_channel = ADC_CHANNEL1; }; break;
+static int i2c_open (struct adc_session *s, const char *bus) {
+  s->fh = open(bus, O_RDWR);
+  return s->fh < 0 ? -1 : 0;
+}
+
+static void i2c_close (struct adc_session *s) {
+  if (s->fh >= 0) close (s->fh);
+  s->fh = -1;
+}
+
+static int i2c_address (struct adc_session *s, int adc) {
+  return ioctl(s->fh, I2C_SLAVE, adc) < 0 ? -1 : 0;
+}
+
+static int i2c_write (struct adc_session *s, __u8 config) {
+  return write(s->fh, &config, 1) == 1 ? 0 : -1;
+}
+
+static int i2c_read (struct adc_session *s, __u8 *res, int len) {
+  return read(s->fh, res, len) == len ? 0 : -1;
+}
+
+static long i2c_conversion_ns (struct adc_session *s, __u8 config) {
+  return adc_conversion_ns(config);
+}
+
+const struct adc_backend adc_i2c = {
+  i2c_open, i2c_close, i2c_address, i2c_write, i2c_read, i2c_conversion_ns
+};
+
+int adc_open (struct adc_session *s, const char *bus) {
+  return adc_open_backend(s, &adc_i2c, bus);
+}
+
+int adc_open_backend (struct adc_session *s, const struct adc_backend *backend, const char *bus) {
+  int chn;
+
+  for (chn = 1; chn <= ADC_CHANNELS; chn++)
+    adc_set_mode(s, chn, ADC_DEFAULT_BITS, ADC_DEFAULT_GAIN);
+  s->backend = backend;
+  s->priv = NULL;
+  s->fh = -1;
+  s->address = -1;
+  return backend->open(s, bus);
+}
+
+void adc_close (struct adc_session *s) {
+  s->backend->close(s);
+  s->address = -1;
+}
+
+// only talk to the kernel when the loop moves to the other chip
+static int adc_select (struct adc_session *s, int adc) {
+  if (s->address == adc) return 0;
+  if (s->backend->address(s, adc) < 0) {
+    s->address = -1;
+    return -1;
+  }
+  s->address = adc;
+  return 0;
+}
+
+// build the config byte for an input (1-4) at 12, 14, 16 or 18 bits and
+// gain 1, 2, 4 or 8, and the volts per code it gives
+int adc_config (int input, int bits, int gain, __u8 *config, float *multiplier) {
+  int rate, pga;
+
+  if (input < 1 || input > 4) return -1;
+  switch (bits) {
+  case 12: rate = 0; break;
+  case 14: rate = 1; break;
+  case 16: rate = 2; break;
+  case 18: rate = 3; break;
+  default: return -1;
+  }
+  switch (gain) {
+  case 1: pga = 0; break;
+  case 2: pga = 1; break;
+  case 4: pga = 2; break;
+  case 8: pga = 3; break;
+  default: return -1;
   }
-  // open /dev/i2c-0 for version 1 Raspberry Pi boards
-  // open /dev/i2c-1 for version 2 Raspberry Pi boards
-  fh = open("/dev/i2c-1", O_RDWR);
-  ioctl(fh, I2C_SLAVE, adc);
+  *config = ADC_READY | ((input - 1) << ADC_INPUT_SHIFT) | ADC_CONTINUOUS | (rate << 2) | pga;
+  // full scale is +-2.048V over the resolution, divided down by the gain
+  *multiplier = 4.096 / (1 << bits) / gain;
+  return 0;
+}
+
+int adc_set_mode (struct adc_session *s, int chn, int bits, int gain) {
+  if (chn < 1 || chn > ADC_CHANNELS) return -1;
+  return adc_config((chn - 1) % 4 + 1, bits, gain, &s->config[chn - 1], &s->multiplier[chn - 1]);
+}
+
+// nominal conversion time for the 240, 60, 15 and 3.75 samples per second modes
+long adc_conversion_ns (__u8 config) {
+  static const long period[4] = { 4166667, 16666667, 66666667, 266666667 };
+  return period[(config & ADC_RATE_MASK) >> 2];
+}
+
+static void timespec_add_ns (struct timespec *t, long ns) {
+  t->tv_nsec += ns;
+  while (t->tv_nsec >= 1000000000L) {
+    t->tv_nsec -= 1000000000L;
+    t->tv_sec++;
+  }
+}
+
+static long timespec_diff_ns (const struct timespec *a, const struct timespec *b) {
+  return (a->tv_sec - b->tv_sec) * 1000000000L + (a->tv_nsec - b->tv_nsec);
+}
+
+static void sleep_until (const struct timespec *t) {
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, t, NULL) == EINTR)
+    ;
+}
+
+// channels 1-4 are on ADC_1, 5-8 on ADC_2 and so on up the bus
+static unsigned int adc_map (int chn) {
+  return chn >= 1 && chn <= ADC_CHANNELS ? ADC_1 + (chn - 1) / 4 : ADC_1;
+}
+
+static int adc_request (struct adc_session *s, int chn, __u8 config, float multiplier) {
+  unsigned int adc;
+  struct adc_conversion *c;
+
+  adc = adc_map(chn);
+  c = &s->chip[adc - ADC_1];
+  if (adc_select(s, adc) < 0) return -1;
+  c->config = config;
+  c->multiplier = multiplier;
   // send request for channel
-  i2c_smbus_write_byte (fh, adc_channel);
-  usleep (50000);
-  // read 4 bytes of data
-  i2c_smbus_read_i2c_block_data(fh, adc_channel, 4, res);
-  // loop to check new value is available and then return value
-  while (res[3] & 128) {
-    // read 4 bytes of data
-    i2c_smbus_read_i2c_block_data(fh, adc_channel, 4, res);
+  if (s->backend->write(s, c->config) < 0) return -1;
+  clock_gettime(CLOCK_MONOTONIC, &c->started);
+  c->deadline = c->started;
+  timespec_add_ns(&c->deadline, s->backend->conversion_ns(s, c->config));
+  return 0;
+}
+
+// request a conversion and work out when it will be ready.  Returns at
+// once, so the other chips can be started while this one converts.
+int adc_start (struct adc_session *s, int chn) {
+  if (chn < 1 || chn > ADC_CHANNELS) chn = 1;
+  return adc_request(s, chn, s->config[chn - 1], s->multiplier[chn - 1]);
+}
+
+// sleep until the conversion on the channel's chip should be done, then
+// poll the ready bit
+int adc_collect (struct adc_session *s, int chn, float *val, long *waited_ns) {
+  unsigned int dummy, adc;
+  struct adc_conversion *c;
+  struct timespec now;
+  long interval;
+  int polls, bits;
+  __u8  res[4];
+
+  adc = adc_map(chn);
+  c = &s->chip[adc - ADC_1];
+  bits = 12 + 2 * ((c->config & ADC_RATE_MASK) >> 2);
+  interval = s->backend->conversion_ns(s, c->config) / 16;
+  sleep_until(&c->deadline);
+  if (adc_select(s, adc) < 0) return -1;
+  for (polls = 0; ; polls++) {
+    // read 4 bytes of data, the config byte follows 3 data bytes in 18 bit
+    // mode and 2 otherwise
+    if (s->backend->read(s, res, 4) < 0) return -1;
+    if (!(res[bits == 18 ? 3 : 2] & ADC_READY)) break;
+    if (polls == ADC_POLL_LIMIT) return -1;
+    timespec_add_ns(&c->deadline, interval);
+    sleep_until(&c->deadline);
   }
-  usleep(50000);
-  close (fh);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  c->waited_ns = timespec_diff_ns(&now, &c->started);
+  if (waited_ns) *waited_ns = c->waited_ns;
 
   // shift bits to product result
-  dummy = ((res[0] & 0b00000001) << 16) | (res[1] << 8) | res[2];
+  if (bits == 18)
+    dummy = (res[0] << 16) | (res[1] << 8) | res[2];
+  else
+    dummy = (res[0] << 8) | res[1];
+  dummy &= (1 << bits) - 1;
+
+  // check if positive or negative number and sign extend if needed
+  c->code = (int)dummy;
+  if (dummy & (1 << (bits - 1))) c->code -= 1 << bits;
+
+  *val = (float)c->code * c->multiplier;
+  return 0;
+}
+
+float adc_read (struct adc_session *s, int chn) {
+  float val;
 
-  // check if positive or negative number and invert if needed
-  if (res[0] >= 128) dummy = ~(0x020000 - dummy);
+  if (adc_start(s, chn) < 0 || adc_collect(s, chn, &val, NULL) < 0) return 0;
+  return val;
+}
+
+// lock a channel into continuous conversion at the given resolution, keeping
+// its gain.  The chip's other inputs are not converted until the next
+// adc_start().
+int adc_capture_start (struct adc_session *s, int chn, int bits) {
+  __u8 config;
+  float multiplier;
+
+  if (chn < 1 || chn > ADC_CHANNELS) return -1;
+  if (adc_config((chn - 1) % 4 + 1, bits, 1 << (s->config[chn - 1] & ADC_GAIN_MASK),
+      &config, &multiplier) < 0) return -1;
+  return adc_request(s, chn, config, multiplier);
+}
+
+// wait for the next result of a capture.  The chip keeps converting, so the
+// following result is due one conversion time after this one was seen.
+int adc_capture_next (struct adc_session *s, int chn, float *val) {
+  struct adc_conversion *c;
+  long period;
+
+  if (adc_collect(s, chn, val, NULL) < 0) return -1;
+  c = &s->chip[adc_map(chn) - ADC_1];
+  period = s->backend->conversion_ns(s, c->config);
+  clock_gettime(CLOCK_MONOTONIC, &c->started);
+  c->deadline = c->started;
+  timespec_add_ns(&c->deadline, period - period / 16);
+  return 0;
+}
+
+// read a layout such as "/dev/i2c-1=0x68,0x69;/dev/i2c-3=0x6a": each bus
+// device followed by the chip addresses on it.  Returns the number of
+// channels, four per chip, or -1 if the spec is no good.
+int adc_parse_layout (const char *spec, struct adc_layout *l) {
+  const char *p = spec, *eq;
+  char *end;
+  long addr;
+  int b, i;
 
-  val = (float)((int)dummy) * varMultiplier;
+  memset(l, 0, sizeof(*l));
+  while (*p) {
+    b = l->buses;
+    eq = strchr(p, '=');
+    if (b == ADC_BUSES || eq == NULL || eq == p || eq - p >= (int)sizeof(l->bus[b])) return -1;
+    memcpy(l->bus[b], p, eq - p);
+    l->first[b] = l->channels;
+    p = eq;
+    do {
+      addr = strtol(p + 1, &end, 0);
+      if (end == p + 1 || addr < ADC_1 || addr >= ADC_1 + ADC_CHIPS || l->chips[b] == ADC_CHIPS) return -1;
+      for (i = 0; i < l->chips[b]; i++)
+        if (l->address[b][i] == addr) return -1;
+      l->address[b][l->chips[b]++] = (int)addr;
+      l->channels += 4;
+      p = end;
+    } while (*p == ',');
+    if (*p == ';') p++;
+    else if (*p) return -1;
+    l->buses++;
+  }
+  return l->buses ? l->channels : -1;
+}
+
+// find the bus a layout channel (0 based) is on.  Returns the channel
+// number to use on that bus's session, 1 to ADC_CHANNELS.
+int adc_layout_input (const struct adc_layout *l, int channel, int *bus) {
+  int b;
+
+  for (b = l->buses - 1; b > 0 && channel < l->first[b]; b--)
+    ;
+  channel -= l->first[b];
+  *bus = b;
+  return (l->address[b][channel / 4] - ADC_1) * 4 + channel % 4 + 1;
+}
+
+// stateless read, opens and closes the bus around a single sample
+float getadc (int chn) {
+  struct adc_session s;
+  float val;
+
+  if (adc_open(&s, ADC_BUS) < 0) return 0;
+  val = adc_read(&s, chn);
+  adc_close(&s);
   return val;
-}
\ No newline at end of file
+}
@@ -1,13 +1,37 @@
 #ifndef ADCPIV3_H
 #define ADCPIV3_H
 
-// define adc chips addresses and channel modes
+// define adc chips addresses, four inputs on each.  A bus takes up to 8
+// chips, 0x68 to 0x6F, so up to 4 stacked boards
 #define ADC_1     0x68
 #define ADC_2     0x69
-#define ADC_CHANNEL1  0x9C
-#define ADC_CHANNEL2  0xBC
-#define ADC_CHANNEL3  0xDC
-#define ADC_CHANNEL4  0xFC
+#define ADC_CHIPS     8
+#define ADC_CHANNELS  (4 * ADC_CHIPS)   // inputs on one bus, 1-4 on 0x68, 5-8 on 0x69...
+#define ADC_BUSES     4
+
+// open /dev/i2c-0 for version 1 Raspberry Pi boards
+// open /dev/i2c-1 for version 2 Raspberry Pi boards
+#define ADC_BUS   "/dev/i2c-1"
+
+// one board on the default bus, see adc_parse_layout()
+#define ADC_LAYOUT  ADC_BUS "=0x68,0x69"
+
+// config byte fields
+#define ADC_READY       0x80  // write: start conversion, read: result not ready
+#define ADC_INPUT_SHIFT 5     // input 1-4 select
+#define ADC_CONTINUOUS  0x10  // continuous rather than one-shot conversion
+#define ADC_RATE_MASK   0x0C  // sample rate / resolution select
+#define ADC_GAIN_MASK   0x03  // PGA gain select
+
+// default mode, 18 bit at 3.75 samples per second and gain 1
+#define ADC_DEFAULT_BITS  18
+#define ADC_DEFAULT_GAIN  1
+
+// capture mode runs the chip at its full rate, 240 samples per second
+#define ADC_CAPTURE_BITS  12
+
+// ready bit is polled at most this many times past the expected conversion time
+#define ADC_POLL_LIMIT  32
 
 #include <stdio.h>
 #include <stdint.h>
@@ -19,10 +43,72 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <time.h>
 #include <linux/i2c-dev.h>
 
-extern const float varDivisior; // from pdf sheet on adc addresses and config for 18 bit mode
-float varMultiplier;
+struct adc_session;
+
+// bus operations behind a session, the i2c driver in adcpiv3.c or the
+// simulator in adcsim.c.  All return -1 on failure.
+struct adc_backend {
+  int (*open) (struct adc_session *s, const char *bus);
+  void (*close) (struct adc_session *s);
+  int (*address) (struct adc_session *s, int adc);        // select a chip
+  int (*write) (struct adc_session *s, __u8 config);      // write its config byte
+  int (*read) (struct adc_session *s, __u8 *res, int len); // read result and config
+  long (*conversion_ns) (struct adc_session *s, __u8 config); // expected conversion time
+};
+
+extern const struct adc_backend adc_i2c;
+
+// a conversion that has been requested from one of the chips
+struct adc_conversion {
+  __u8 config;               // config byte of the conversion in progress
+  float multiplier;          // volts per code in that mode
+  int code;                  // sign extended result of the last conversion
+  struct timespec started;   // when the conversion was requested
+  struct timespec deadline;  // when the result is expected to be ready
+  long waited_ns;            // request to ready bit, of the last conversion
+};
+
+// an open i2c bus, kept between samples so that only the slave address
+// has to be re-issued when switching between chips.  Each chip keeps its
+// own conversion so they can all be busy at the same time.
+struct adc_session {
+  const struct adc_backend *backend;
+  void *priv;   // backend state
+  int fh;       // file handle of the open bus, -1 if closed
+  int address;  // slave address currently selected, -1 if none
+  struct adc_conversion chip[ADC_CHIPS];  // ADC_1 onwards
+  __u8 config[ADC_CHANNELS];        // per input resolution and gain
+  float multiplier[ADC_CHANNELS];
+};
+
+// which bus and chips each channel is on: the chips of the first bus in
+// the order given, four channels each, then those of the next bus
+struct adc_layout {
+  int buses;
+  char bus[ADC_BUSES][64];        // device, passed to the backend's open
+  int chips[ADC_BUSES];
+  int address[ADC_BUSES][ADC_CHIPS];
+  int first[ADC_BUSES];           // first channel on each bus, 0 based
+  int channels;
+};
+
+int adc_open (struct adc_session *s, const char *bus);
+int adc_open_backend (struct adc_session *s, const struct adc_backend *backend, const char *bus);
+void adc_close (struct adc_session *s);
+int adc_config (int input, int bits, int gain, __u8 *config, float *multiplier);
+int adc_set_mode (struct adc_session *s, int chn, int bits, int gain);
+long adc_conversion_ns (__u8 config);
+int adc_start (struct adc_session *s, int chn);
+int adc_collect (struct adc_session *s, int chn, float *val, long *waited_ns);
+float adc_read (struct adc_session *s, int chn);
+int adc_capture_start (struct adc_session *s, int chn, int bits);
+int adc_capture_next (struct adc_session *s, int chn, float *val);
+
+int adc_parse_layout (const char *spec, struct adc_layout *l);
+int adc_layout_input (const struct adc_layout *l, int channel, int *bus);
 
 float getadc (int chn);
 
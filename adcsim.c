@@ -0,0 +1,269 @@
+/*
+Simulated ADC Pi backend, see adcsim.h for the spec string.
+
+Conversions complete one conversion time after the config byte is
+written, and every conversion time after that in continuous mode.  A read
+before then returns the previous result with the ready bit set, so the
+acquisition code polls exactly as it would on the bus.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "adcsim.h"
+
+enum wave_kind { WAVE_DC, WAVE_SINE, WAVE_SQUARE, WAVE_STEP, WAVE_NOISE };
+
+struct wave {
+  enum wave_kind kind;
+  double a, b, c;
+};
+
+struct sim_chip {
+  __u8 config;              // last config byte written
+  struct timespec written;  // when it was written, conversions start here
+  long taken;               // conversions already read since then
+  int code;                 // last converted result
+};
+
+struct adcsim {
+  struct wave wave[ADC_CHANNELS];
+  double delay;
+  struct timespec epoch;
+  struct sim_chip chip[ADC_CHIPS];
+  double *replay_t;         // replay sample times, seconds
+  float *replay_v;          // ADC_CHANNELS volts per sample
+  int replay_n;
+  unsigned int seed;
+};
+
+static double elapsed (const struct timespec *now, const struct timespec *from) {
+  return (now->tv_sec - from->tv_sec) + (now->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static int load_replay (struct adcsim *sim, const char *path) {
+  FILE *fp;
+  char line[1024];
+  char *p, *end;
+  double *t;
+  float *v;
+  int i, size = 0, ret = 0;
+
+  fp = fopen(path, "r");
+  if (fp == NULL) return -1;
+  while (fgets(line, sizeof(line), fp)) {
+    if (sim->replay_n == size) {
+      size = size ? size * 2 : 1024;
+      // what was read before a failure is freed by sim_close()
+      t = realloc(sim->replay_t, size * sizeof(double));
+      if (t != NULL) sim->replay_t = t;
+      v = t ? realloc(sim->replay_v, size * ADC_CHANNELS * sizeof(float)) : NULL;
+      if (v != NULL) sim->replay_v = v;
+      if (v == NULL) {
+        ret = -1;
+        break;
+      }
+    }
+    sim->replay_t[sim->replay_n] = strtod(line, &end);
+    if (end == line) continue;  // header or blank line
+    p = end;
+    for (i = 0; i < ADC_CHANNELS; i++) {
+      if (*p == ',') p++;
+      sim->replay_v[sim->replay_n * ADC_CHANNELS + i] = strtod(p, &end);
+      p = end;
+    }
+    sim->replay_n++;
+  }
+  fclose(fp);
+  return ret == 0 && sim->replay_n > 0 ? 0 : -1;
+}
+
+static int parse_spec (struct adcsim *sim, const char *spec) {
+  char *copy, *item, *save, *kind, *arg;
+  double v[4];
+  int chn, n, ret = 0;
+
+  copy = strdup(spec);
+  for (item = strtok_r(copy, ";", &save); item; item = strtok_r(NULL, ";", &save)) {
+    if (strncmp(item, "replay=", 7) == 0) {
+      if (load_replay(sim, item + 7) < 0) ret = -1;
+      continue;
+    }
+    if (strncmp(item, "delay=", 6) == 0) {
+      sim->delay = atof(item + 6);
+      continue;
+    }
+    chn = atoi(item);
+    kind = strchr(item, '=');
+    if (chn < 1 || chn > ADC_CHANNELS || kind == NULL) {
+      ret = -1;
+      continue;
+    }
+    kind++;
+    memset(v, 0, sizeof(v));
+    n = 0;
+    for (arg = strchr(kind, ':'); arg && n < 4; arg = strchr(arg + 1, ':'))
+      v[n++] = atof(arg + 1);
+    if (strncmp(kind, "dc", 2) == 0) {
+      sim->wave[chn - 1] = (struct wave){ WAVE_DC, v[0], 0, 0 };
+    } else if (strncmp(kind, "sine", 4) == 0) {
+      sim->wave[chn - 1] = (struct wave){ WAVE_SINE, v[0], v[1], v[2] };
+    } else if (strncmp(kind, "square", 6) == 0) {
+      sim->wave[chn - 1] = (struct wave){ WAVE_SQUARE, v[0], v[1], v[2] };
+    } else if (strncmp(kind, "step", 4) == 0) {
+      sim->wave[chn - 1] = (struct wave){ WAVE_STEP, v[0], v[1], v[2] };
+    } else if (strncmp(kind, "noise", 5) == 0) {
+      sim->wave[chn - 1] = (struct wave){ WAVE_NOISE, v[0], v[1], 0 };
+    } else {
+      ret = -1;
+    }
+  }
+  free(copy);
+  return ret;
+}
+
+// voltage at a channel's input t seconds after opening
+static double sample (struct adcsim *sim, int chn, double t) {
+  struct wave *w = &sim->wave[chn - 1];
+  int lo, hi, mid;
+  double span;
+
+  if (sim->replay_n > 0) {
+    span = sim->replay_t[sim->replay_n - 1] - sim->replay_t[0];
+    t = sim->replay_t[0] + (span > 0 ? fmod(t, span) : 0);
+    // last recorded sample at or before t
+    lo = 0;
+    hi = sim->replay_n - 1;
+    while (lo < hi) {
+      mid = (lo + hi + 1) / 2;
+      if (sim->replay_t[mid] <= t) lo = mid; else hi = mid - 1;
+    }
+    return sim->replay_v[lo * ADC_CHANNELS + chn - 1];
+  }
+
+  switch (w->kind) {
+  case WAVE_SINE: return w->c + w->a * sin(2 * M_PI * w->b * t);
+  case WAVE_SQUARE: return w->c + (fmod(t * w->b, 1.0) < 0.5 ? w->a : -w->a);
+  case WAVE_STEP: return t < w->c ? w->a : w->b;
+  case WAVE_NOISE:
+    sim->seed = sim->seed * 1103515245 + 12345;
+    return w->b + w->a * (2.0 * (sim->seed >> 8) / (1 << 24) - 1.0);
+  default: return w->a;
+  }
+}
+
+// the result code the chip would give for the config byte
+static int convert (struct adcsim *sim, __u8 config, int address, double t) {
+  int chn, bits, limit;
+  double lsb, code;
+
+  chn = (address - ADC_1) * 4 + ((config >> ADC_INPUT_SHIFT) & 3) + 1;
+  bits = 12 + 2 * ((config & ADC_RATE_MASK) >> 2);
+  lsb = 4.096 / (1 << bits) / (1 << (config & ADC_GAIN_MASK));
+  limit = 1 << (bits - 1);
+  code = floor(sample(sim, chn, t) / lsb + 0.5);
+  if (code > limit - 1) code = limit - 1;
+  if (code < -limit) code = -limit;
+  return (int)code;
+}
+
+static int sim_open (struct adc_session *s, const char *bus) {
+  struct adcsim *sim;
+
+  sim = calloc(1, sizeof(*sim));
+  if (sim == NULL) return -1;
+  sim->delay = 1;
+  sim->seed = 1;
+  clock_gettime(CLOCK_MONOTONIC, &sim->epoch);
+  s->priv = sim;
+  if (bus && parse_spec(sim, bus) < 0) {
+    s->backend->close(s);
+    return -1;
+  }
+  return 0;
+}
+
+static void sim_close (struct adc_session *s) {
+  struct adcsim *sim = s->priv;
+
+  if (sim == NULL) return;
+  free(sim->replay_t);
+  free(sim->replay_v);
+  free(sim);
+  s->priv = NULL;
+}
+
+// every address a stack of boards can be set to answers
+static int sim_address (struct adc_session *s, int adc) {
+  return adc >= ADC_1 && adc < ADC_1 + ADC_CHIPS ? 0 : -1;
+}
+
+static int sim_write (struct adc_session *s, __u8 config) {
+  struct adcsim *sim = s->priv;
+  struct sim_chip *c = &sim->chip[s->address - ADC_1];
+
+  c->config = config & ~ADC_READY;
+  clock_gettime(CLOCK_MONOTONIC, &c->written);
+  c->taken = 0;
+  return 0;
+}
+
+static long sim_conversion_ns (struct adc_session *s, __u8 config) {
+  struct adcsim *sim = s->priv;
+
+  return (long)(adc_conversion_ns(config) * sim->delay);
+}
+
+static int sim_read (struct adc_session *s, __u8 *res, int len) {
+  struct adcsim *sim = s->priv;
+  struct sim_chip *c = &sim->chip[s->address - ADC_1];
+  struct timespec now;
+  double period;
+  long done;
+  __u8 status;
+  __u8 out[4];
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  period = sim_conversion_ns(s, c->config) / 1e9;
+  done = period > 0 ? (long)(elapsed(&now, &c->written) / period) : c->taken + 1;
+  if (!(c->config & ADC_CONTINUOUS) && done > 1) done = 1;
+
+  status = c->config | ADC_READY;
+  if (done > c->taken) {
+    c->taken = done;
+    c->code = convert(sim, c->config, s->address,
+                      elapsed(&c->written, &sim->epoch) + done * period);
+    status = c->config;
+  }
+
+  if (((c->config & ADC_RATE_MASK) >> 2) == 3) {
+    out[0] = (c->code >> 16) & 0xFF;
+    out[1] = (c->code >> 8) & 0xFF;
+    out[2] = c->code & 0xFF;
+    out[3] = status;
+  } else {
+    out[0] = (c->code >> 8) & 0xFF;
+    out[1] = c->code & 0xFF;
+    out[2] = status;
+    out[3] = status;
+  }
+  memcpy(res, out, len < 4 ? len : 4);
+  return 0;
+}
+
+const struct adc_backend adc_sim = {
+  sim_open, sim_close, sim_address, sim_write, sim_read, sim_conversion_ns
+};
+
+int adcsim_epoch (struct adc_session *s, struct timespec *epoch) {
+  struct adcsim *sim = s->priv;
+
+  // a wrapped simulator, like bench's, still closes through sim_close()
+  if (s->backend == NULL || s->backend->close != sim_close || sim == NULL) return -1;
+  *epoch = sim->epoch;
+  return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef ADCSIM_H
+#define ADCSIM_H
+
+/*
+Simulated ADC Pi backend for running vehicleMon off-vehicle.
+
+The simulator answers on every address from ADC_1 to 0x6F like a bus of
+MCP3424s, with the same 4 byte result and config encoding, and holds the ready bit until the
+conversion time of the written config has passed.  It is opened with a spec
+string instead of a bus device:
+
+  item[;item...]
+
+  N=dc:V            constant V volts on channel N (1-32, 0x68 + (N-1)/4)
+  N=sine:A:F[:V]    sine of amplitude A volts at F Hz about V
+  N=square:A:F[:V]  square wave of amplitude A volts at F Hz about V
+  N=step:V1:V2:T    V1 until T seconds after opening, then V2
+  N=noise:A[:V]     uniform noise of amplitude A volts about V
+  replay=FILE       replay "time,v1,...,v32" lines, looping at the end
+  delay=X           scale conversion times by X, 0 for no wait
+
+Channels without an item read 0 V, as do the channels missing from a shorter
+replay line.  When a layout has several buses each is opened with the same
+spec, so N is the same input of the same address on every bus.  Voltages are as seen at the adc input,
+before the gradient/offset calibration.
+*/
+
+#include "adcpiv3.h"
+
+extern const struct adc_backend adc_sim;
+
+// time the simulator was opened, the origin of step items and replays.
+// Returns -1 if the session is not on the simulator
+int adcsim_epoch (struct adc_session *s, struct timespec *epoch);
+
+#endif /* ADCSIM_H */
@@ -0,0 +1,88 @@
+/**
+ * 	alarm.c:
+ *
+ *  Alarm rules evaluated over a set of channels, see alarm.h.  The tests
+ *  are done with bitwise operators on comparison results, so a channel
+ *  costs the same whichever state it is in.
+ ***********************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "alarm.h"
+
+int alarm_init (struct alarm *a, int nchannels, const struct alarm_rules *rules)
+{
+	memset(a, 0, sizeof(*a));
+	a->nchannels = nchannels;
+	a->rules = *rules;
+	a->out_since = calloc(nchannels, sizeof(int64_t));
+	return a->out_since ? 0 : -1;
+}
+
+/*
+ * alarm_eval:
+ *  Check the channels in mask against their rules.  events must have room
+ *  for one per channel.
+ *
+ *  @return: the number of events, trips and clears, written to events.
+ *********************************************************************************
+ */
+
+int alarm_eval (struct alarm *a, const double *values, unsigned long mask, int64_t now_ns,
+		struct alarm_event *events)
+{
+	const struct alarm_rules *r = &a->rules;
+	int j, n = 0;
+	int inverted, armed, tripped, bad, good, trip, clear;
+	double v, lo, hi, h, hb;
+
+	for (j = 0; j < a->nchannels; j++)
+	{
+		if (!(mask & (1UL << j)))
+		{
+			continue;
+		}
+
+		v = values[j];
+		lo = fmin(r->min[j], r->max[j]);
+		hi = fmax(r->min[j], r->max[j]);
+		h = r->hysteresis[j];
+		hb = fmin(h, (hi - lo) / 4);
+		inverted = r->mode[j] == ALARM_INVERTED;
+		armed = r->armed[j] != 0;
+		tripped = (a->tripped >> j) & 1;
+
+		// out of range trips, and clearing takes a margin of h the other way,
+		// inside a band no more than a quarter of it from each side
+		bad = ((v < lo) | (v > hi)) ^ inverted;
+		good = (inverted & ((v < lo - h) | (v > hi + h))) |
+				(!inverted & (v >= lo + hb) & (v <= hi - hb));
+
+		if (!bad)
+		{
+			a->out_since[j] = 0;
+		}
+		else if (a->out_since[j] == 0)
+		{
+			a->out_since[j] = now_ns;
+		}
+
+		trip = armed & !tripped & bad & (now_ns - a->out_since[j] >= r->delay_ms[j] * 1000000LL);
+		clear = tripped & (good | !armed);
+		if (!(trip | clear))
+		{
+			continue;
+		}
+
+		a->tripped ^= 1UL << j;
+		events[n].channel = j;
+		events[n].change = trip ? ALARM_TRIP : ALARM_CLEAR;
+		events[n].value = v;
+		events[n].t_ns = now_ns;
+		n++;
+	}
+	return n;
+}
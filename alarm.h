@@ -0,0 +1,61 @@
+#ifndef ALARM_H
+#define ALARM_H
+
+/*
+ * alarm.h:
+ *  Alarm engine.  Each channel has a rule read from the live settings
+ *  arrays: a band between alarm_min and alarm_max (either way round) that
+ *  the value must stay inside, or with ALARM_INVERTED must stay outside; a
+ *  hysteresis margin it must come back past before the alarm clears, for a
+ *  band at most a quarter of its width so that the middle always clears; and
+ *  how long it must be out before the alarm trips.  alarm_eval() checks a
+ *  set of channels in one pass and reports only the changes, as events.
+ *********************************************************************************
+ */
+
+#include <stdint.h>
+
+enum alarm_mode
+{
+	ALARM_BAND,			// trip outside the band
+	ALARM_INVERTED			// trip inside it
+};
+
+enum alarm_change
+{
+	ALARM_TRIP,
+	ALARM_CLEAR
+};
+
+// the settings arrays the rules are read from, one element per channel
+struct alarm_rules
+{
+	const double *max;
+	const double *min;
+	const double *hysteresis;	// volts
+	const int *delay_ms;		// time out of range before tripping
+	const int *mode;		// enum alarm_mode
+	const int *armed;
+};
+
+struct alarm_event
+{
+	int channel;
+	int change;			// enum alarm_change
+	double value;
+	int64_t t_ns;
+};
+
+struct alarm
+{
+	int nchannels;
+	struct alarm_rules rules;
+	unsigned long tripped;		// bit per channel
+	int64_t *out_since;		// when each channel went out, 0 while in
+};
+
+int alarm_init (struct alarm *a, int nchannels, const struct alarm_rules *rules);
+int alarm_eval (struct alarm *a, const double *values, unsigned long mask, int64_t now_ns,
+		struct alarm_event *events);
+
+#endif /* ALARM_H */
@@ -0,0 +1,342 @@
+/**
+ * 	bench.c:
+ *
+ *  Benchmark the acquisition, alarm and render paths of vehicleMon against
+ *  the simulated adc (adcsim.c) and display (geniesim.c), no hardware needed.
+ *
+ *		gcc -DVEHICLEMON_NO_MAIN bench.c vehicleMon.c adcpiv3.c adcsim.c ring.c genieq.c render.c recorder.c snapshot.c samplelog.c confstore.c alarm.c sampler.c evloop.c latency.c liveboard.c scope.c rtsched.c geniesim.c \
+ *			-o bench -lgeniePi -lm -lpthread -lrt
+ *		./bench -t 20 -o bench_results.json
+ *
+ *  Channel 1 is fed a square wave that leaves its alarm band on every rising
+ *  edge; the time from each edge to the first GENIE_OBJ_SOUND frame on the
+ *  display is the alarm latency.  Sample times are taken as the adc reports
+ *  each result ready, and serial use is counted from the frames the display
+ *  receives.  Results are printed and written as JSON.  The flight recorder
+ *  and sample log run as they would in the car, into files removed at the
+ *  end; alarm snapshots are left beside bench_snapshots.csv, and the stage
+ *  latency histograms are summed up in bench_latency.csv.
+ *
+ *  Options:
+ *	-t seconds	run time (20)
+ *	-o file		JSON results (bench_results.json)
+ *	-f hertz	square wave frequency on channel 1 (0.25)
+ *	-d scale	conversion delay scale of the simulated adc (1)
+ *	-m bits		resolution of every channel (18)
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include <pthread.h>
+
+#include <geniePi.h>
+
+#include "adcpiv3.h"
+#include "adcsim.h"
+#include "geniesim.h"
+
+#define max_edges 1024
+
+// from vehicleMon.c
+extern char *data_file;
+extern char *display_device;
+extern char *recorder_file;
+extern char *snapshot_index;
+extern char *log_file;
+extern char *board_name;
+extern double gradient[], offset[], max[], min[];
+extern double alarm_max[], alarm_min[];
+extern int armed[];
+extern int resolution[];
+extern int setup (void);
+extern int start_acquisition (const struct adc_backend *backend, const char *bus);
+extern void *event_loop (void *data);
+extern void write_latency (void);
+extern char *latency_file;
+extern int channels;
+
+struct channel_stats
+{
+	long samples;
+	struct timespec last;
+	double sum, sum_sq;	// of the intervals, seconds
+	double min, max;
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct channel_stats stats[ADC_CHANNELS];
+
+static struct timespec epoch;	// of the simulated adc, square wave origin
+static double frequency = 0.25;
+static double latency[max_edges];
+static int last_edge = 0;	// rising edges already answered
+static int alarms = 0;		// latencies recorded
+static long display_bytes;	// frames written by updateDisplay
+
+static struct adc_backend bench_adc;
+static struct adc_session *bench_session;
+
+static double seconds (const struct timespec *t, const struct timespec *from)
+{
+	return (t->tv_sec - from->tv_sec) + (t->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/*
+ * bench_open, bench_read:
+ *  The simulated adc, timestamping every result that comes back ready.
+ *********************************************************************************
+ */
+
+static int bench_open (struct adc_session *s, const char *bus)
+{
+	bench_session = s;
+	if (adc_sim.open(s, bus) < 0)
+	{
+		return -1;
+	}
+	return adcsim_epoch(s, &epoch);
+}
+
+static int bench_read (struct adc_session *s, __u8 *res, int len)
+{
+	struct adc_conversion *c = &s->chip[s->address - ADC_1];
+	struct channel_stats *st;
+	struct timespec now;
+	__u8 status;
+	double dt;
+
+	if (adc_sim.read(s, res, len) < 0)
+	{
+		return -1;
+	}
+
+	status = ((c->config & ADC_RATE_MASK) >> 2) == 3 ? res[3] : res[2];
+	if (status & ADC_READY)
+	{
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	st = &stats[(s->address - ADC_1) * 4 + ((status >> ADC_INPUT_SHIFT) & 3)];
+
+	pthread_mutex_lock(&stats_lock);
+	if (st->samples++ > 0)
+	{
+		dt = seconds(&now, &st->last);
+		st->sum += dt;
+		st->sum_sq += dt * dt;
+		if (st->samples == 2 || dt < st->min)
+		{
+			st->min = dt;
+		}
+		if (dt > st->max)
+		{
+			st->max = dt;
+		}
+	}
+	st->last = now;
+	pthread_mutex_unlock(&stats_lock);
+	return 0;
+}
+
+/*
+ * on_frame:
+ *  Match alarm sounds to the square wave edges and count render traffic.
+ *********************************************************************************
+ */
+
+static void on_frame (struct geniesim *g, const struct geniesim_frame *f, void *arg)
+{
+	int edge;
+
+	if ((f->cmd == GENIE_WRITE_STR && f->index < channels) ||
+			(f->cmd == GENIE_WRITE_OBJ && f->object == GENIE_OBJ_SCOPE))
+	{
+		display_bytes += f->length;
+	}
+
+	if (f->cmd != GENIE_WRITE_OBJ || f->object != GENIE_OBJ_SOUND || f->index != 0 ||
+			bench_session == NULL)
+	{
+		return;
+	}
+
+	// the wave rises at every whole period after the epoch, skip the one at 0
+	edge = (int)floor(seconds(&f->when, &epoch) * frequency);
+	if (edge > last_edge && alarms < max_edges)
+	{
+		latency[alarms++] = seconds(&f->when, &epoch) - edge / frequency;
+		last_edge = edge;
+	}
+}
+
+static int compare (const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+// the nearest rank q (0 to 1) of n sorted values, 0 if there are none
+static double quantile (const double *sorted, int n, double q)
+{
+	int rank = (int)ceil(q * n);
+
+	return n ? sorted[rank > 0 ? rank - 1 : 0] : 0;
+}
+
+int main (int argc, char **argv)
+{
+	int i, opt, edges, bits = ADC_DEFAULT_BITS;
+	double duration = 20, delay = 1;
+	double elapsed, mean, jitter, total;
+	char *output = "bench_results.json";
+	char spec[256];
+	struct geniesim display;
+	struct timespec end;
+	pthread_t ui;
+	FILE *out;
+
+	while ((opt = getopt(argc, argv, "t:o:f:d:m:")) != -1)
+	{
+		switch (opt)
+		{
+		case 't': duration = atof(optarg); break;
+		case 'o': output = optarg; break;
+		case 'f': frequency = atof(optarg); break;
+		case 'd': delay = atof(optarg); break;
+		case 'm': bits = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-t seconds] [-o file] [-f hertz] [-d scale] [-m bits]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (geniesim_open(&display, NULL) < 0)
+	{
+		fprintf(stderr, "bench: Can't create pty: %s\n", strerror(errno));
+		return 1;
+	}
+	display.on_frame = on_frame;
+	geniesim_start(&display);
+
+	display_device = display.device;
+	data_file = "bench_data.txt";
+	recorder_file = "bench_flight.rec";
+	snapshot_index = "bench_snapshots.csv";
+	log_file = "bench_samples.vsl";
+	board_name = "/vehicleMonBench";
+	latency_file = "bench_latency.csv";
+	unlink(data_file);
+	unlink("bench_data.txt.bak");
+	unlink(recorder_file);
+	unlink(log_file);
+	setup();
+
+	// channel 1 swings between 0.5 V and 1.5 V against a 1 V alarm limit
+	for (i = 0; i < channels; i++)
+	{
+		gradient[i] = 1;
+		offset[i] = 0;
+		max[i] = 2.048;
+		min[i] = -2.048;
+		alarm_max[i] = 1;
+		alarm_min[i] = -1;
+		armed[i] = i == 0;
+		resolution[i] = bits;
+	}
+
+	snprintf(spec, sizeof(spec), "1=square:0.5:%g:1;2=sine:0.5:1;3=noise:0.1:0.5;4=dc:0.8;"
+			"5=sine:0.2:5;6=dc:-0.3;7=noise:0.05;8=dc:0;delay=%g", frequency, delay);
+
+	bench_adc = adc_sim;
+	bench_adc.open = bench_open;
+	bench_adc.read = bench_read;
+	if (start_acquisition(&bench_adc, spec) < 0)
+	{
+		return 1;
+	}
+	pthread_create(&ui, NULL, event_loop, NULL);
+
+	end = epoch;
+	end.tv_sec += (time_t)duration;
+	end.tv_nsec += (long)((duration - floor(duration)) * 1e9);
+	if (end.tv_nsec >= 1000000000L)
+	{
+		end.tv_nsec -= 1000000000L;
+		end.tv_sec++;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &end, NULL) == EINTR)
+		;
+
+	pthread_mutex_lock(&stats_lock);
+	elapsed = duration;
+	edges = alarms;
+	qsort(latency, edges, sizeof(double), compare);
+
+	out = fopen(output, "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "bench: Can't write %s: %s\n", output, strerror(errno));
+		return 1;
+	}
+
+	total = 0;
+	for (i = 0; i < channels; i++)
+	{
+		total += stats[i].samples;
+	}
+
+	fprintf(out, "{\n  \"duration_s\": %.3f,\n  \"resolution_bits\": %d,\n  \"delay_scale\": %g,\n",
+			elapsed, bits, delay);
+	fprintf(out, "  \"sweeps_per_s\": %.4f,\n  \"channels\": [\n", total / channels / elapsed);
+	printf("sweeps per second: %.3f\n", total / channels / elapsed);
+
+	for (i = 0; i < channels; i++)
+	{
+		struct channel_stats *st = &stats[i];
+		long n = st->samples - 1;
+
+		mean = n > 0 ? st->sum / n : 0;
+		jitter = n > 0 ? sqrt(fmax(st->sum_sq / n - mean * mean, 0)) : 0;
+		fprintf(out, "    { \"channel\": %d, \"samples\": %ld, \"interval_ms\": %.3f, "
+				"\"jitter_ms\": %.3f, \"min_ms\": %.3f, \"max_ms\": %.3f }%s\n",
+				i + 1, st->samples, mean * 1000, jitter * 1000, st->min * 1000, st->max * 1000,
+				i < channels - 1 ? "," : "");
+		printf("channel %d: %ld samples, interval %.3f ms, jitter %.3f ms\n",
+				i + 1, st->samples, mean * 1000, jitter * 1000);
+	}
+
+	mean = 0;
+	for (i = 0; i < edges; i++)
+	{
+		mean += latency[i];
+	}
+	mean = edges ? mean / edges : 0;
+
+	fprintf(out, "  ],\n  \"alarm_latency_ms\": { \"count\": %d, \"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+			edges, mean * 1000, quantile(latency, edges, 0.5) * 1000, quantile(latency, edges, 0.99) * 1000,
+			quantile(latency, edges, 1) * 1000);
+	printf("alarm latency: %d alarms, mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+			edges, mean * 1000, quantile(latency, edges, 0.5) * 1000, quantile(latency, edges, 0.99) * 1000,
+			quantile(latency, edges, 1) * 1000);
+
+	fprintf(out, "  \"serial\": { \"bytes_per_s\": %.1f, \"display_bytes_per_s\": %.1f, \"frames_per_s\": %.1f }\n}\n",
+			display.bytes / elapsed, display_bytes / elapsed, display.frames / elapsed);
+	printf("serial: %.1f bytes/s, %.1f from updateDisplay, %.1f frames/s\n",
+			display.bytes / elapsed, display_bytes / elapsed, display.frames / elapsed);
+	write_latency();
+
+	fclose(out);
+	unlink(data_file);
+	unlink("bench_data.txt.bak");
+	unlink(recorder_file);
+	unlink(log_file);
+	return 0;
+}
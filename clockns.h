@@ -0,0 +1,23 @@
+#ifndef CLOCKNS_H
+#define CLOCKNS_H
+
+/*
+ * clockns.h:
+ *  A clock read as nanoseconds, for the modules that timestamp samples.
+ *  CLOCK_REALTIME minus CLOCK_MONOTONIC is the offset they keep to give
+ *  monotonic times back as wall clock ones.
+ *********************************************************************************
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+static inline int64_t clock_ns (clockid_t id)
+{
+	struct timespec t;
+
+	clock_gettime(id, &t);
+	return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+#endif /* CLOCKNS_H */
@@ -0,0 +1,519 @@
+/**
+ * 	confstore.c:
+ *
+ *  Debounced, atomic saving of the settings file and a table-driven
+ *  reader and writer for its contents, see confstore.h.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <math.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "confstore.h"
+
+static void *confstore_loop (void *data);
+
+/*
+ * confstore_start:
+ *  Start the writer thread for the settings file at path.
+ *
+ *  @return: 0 on success or -1.
+ *********************************************************************************
+ */
+
+int confstore_start (struct confstore *cs, const char *path)
+{
+	pthread_condattr_t attr;
+
+	memset(cs, 0, sizeof(*cs));
+	snprintf(cs->path, sizeof(cs->path), "%s", path);
+	snprintf(cs->tmp, sizeof(cs->tmp), "%s.tmp", path);
+	snprintf(cs->bak, sizeof(cs->bak), "%s.bak", path);
+
+	pthread_mutex_init(&cs->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cs->changed, &attr);
+	pthread_condattr_destroy(&attr);
+
+	return pthread_create(&cs->thread, NULL, confstore_loop, cs) == 0 ? 0 : -1;
+}
+
+/*
+ * version_of:
+ *  The version in a settings file's end: trailer.
+ *
+ *  @return: the version, 0 if the file has no trailer or -1 if it is
+ *  missing or empty.
+ *********************************************************************************
+ */
+
+static long version_of (const char *path)
+{
+	FILE *f;
+	char line[64];
+	long version = -1;
+	int last = 0;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+	{
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (version < 0)
+		{
+			version = 0;
+		}
+		if (last)
+		{
+			version = atol(line);
+			last = 0;
+		}
+		else if (strcmp(line, "end:\n") == 0)
+		{
+			last = 1;
+		}
+	}
+	fclose(f);
+	return version;
+}
+
+/*
+ * confstore_pick:
+ *  Choose the settings file to load: the newer of path and path.bak that
+ *  has its trailer.  A path without one is only taken if it looks like a
+ *  whole file from before trailers were written.
+ *
+ *  @return: the file to load, or NULL if there is none and the defaults
+ *  should be saved.
+ *********************************************************************************
+ */
+
+const char *confstore_pick (struct confstore *cs)
+{
+	long cur, bak;
+	FILE *f;
+	char line[64];
+	int whole = 0;
+
+	cur = version_of(cs->path);
+	bak = version_of(cs->bak);
+
+	if (cur > 0 && cur >= bak)
+	{
+		cs->version = cur;
+		return cs->path;
+	}
+	if (bak > 0)
+	{
+		fprintf(stderr, "vehicleMon: %s is incomplete, using %s\n", cs->path, cs->bak);
+		cs->version = bak;
+		return cs->bak;
+	}
+
+	// older files end with the volume: section
+	if (cur == 0 && (f = fopen(cs->path, "r")) != NULL)
+	{
+		while (fgets(line, sizeof(line), f))
+		{
+			whole = whole || strcmp(line, "volume:\n") == 0;
+		}
+		fclose(f);
+	}
+	return whole ? cs->path : NULL;
+}
+
+/*
+ * confstore_update:
+ *  Take a copy of the new settings and return, the file is written later.
+ *
+ *  @return: 0, or -1 if out of memory.
+ *********************************************************************************
+ */
+
+int confstore_update (struct confstore *cs, const char *text, size_t length)
+{
+	char *copy;
+
+	copy = malloc(length);
+	if (copy == NULL)
+	{
+		return -1;
+	}
+	memcpy(copy, text, length);
+
+	pthread_mutex_lock(&cs->lock);
+	free(cs->text);
+	cs->text = copy;
+	cs->length = length;
+	cs->edits++;
+	pthread_cond_broadcast(&cs->changed);
+	pthread_mutex_unlock(&cs->lock);
+	return 0;
+}
+
+/*
+ * confstore_sync:
+ *  Wait until the last update is on disk, e.g. before a reboot, or until
+ *  an attempt to write it has failed.
+ *
+ *  @return: 0 if it is on disk or -1 with errno set if it could not be
+ *  written.
+ *********************************************************************************
+ */
+
+int confstore_sync (struct confstore *cs)
+{
+	int err;
+
+	pthread_mutex_lock(&cs->lock);
+	while (cs->saved != cs->edits && !(cs->error && cs->tried == cs->edits))
+	{
+		pthread_cond_wait(&cs->changed, &cs->lock);
+	}
+	err = cs->saved == cs->edits ? 0 : cs->error;
+	pthread_mutex_unlock(&cs->lock);
+
+	if (err)
+	{
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+static void set_value (const struct confstore_field *f, int i, double v)
+{
+	switch (f->type)
+	{
+	case CONFSTORE_INT:	((int *)f->values)[i] = (int)v; break;
+	case CONFSTORE_LONG:	((long *)f->values)[i] = (long)v; break;
+	default:		((double *)f->values)[i] = v; break;
+	}
+}
+
+static int count_of (const struct confstore_field *f, int nchannels)
+{
+	return f->count == CONFSTORE_PER_CHANNEL ? nchannels : f->count;
+}
+
+static const struct confstore_field *find_field (const struct confstore_field *fields, int n,
+		const char *name, size_t length)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		if (strlen(fields[i].name) == length && strncmp(fields[i].name, name, length) == 0)
+		{
+			return &fields[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * confstore_load:
+ *  Set every field to its default, then read the settings file in one
+ *  pass.  Sections are matched by name in any order; unknown ones are
+ *  skipped, and a value that is missing, not a number, out of range or
+ *  turned down by the field's valid check keeps its default.  Per-channel fields take nchannels values, so a
+ *  file written for fewer channels gives the others their defaults.  A
+ *  NULL path just sets the defaults.
+ *
+ *  @return: the number of values rejected, or -1 if the file could not
+ *  be opened.
+ *********************************************************************************
+ */
+
+int confstore_load (const char *path, const struct confstore_field *fields, int n, int nchannels)
+{
+	const struct confstore_field *f = NULL;
+	char *line = NULL, *p, *end;
+	size_t size = 0;
+	ssize_t length;
+	int i, k = 0, rejected = 0;
+	double v;
+	FILE *in;
+
+	for (i = 0; i < n; i++)
+	{
+		for (k = 0; k < count_of(&fields[i], nchannels); k++)
+		{
+			set_value(&fields[i], k, fields[i].def);
+		}
+	}
+
+	if (path == NULL)
+	{
+		return 0;
+	}
+	in = fopen(path, "r");
+	if (in == NULL)
+	{
+		return -1;
+	}
+
+	while ((length = getline(&line, &size, in)) >= 0)
+	{
+		while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+		{
+			line[--length] = '\0';
+		}
+		if (length == 0)
+		{
+			continue;
+		}
+
+		// a section name, values follow on the lines after it
+		if (line[length - 1] == ':')
+		{
+			f = find_field(fields, n, line, length - 1);
+			k = 0;
+			continue;
+		}
+		if (f == NULL)
+		{
+			continue;
+		}
+
+		for (p = line; *p && k < count_of(f, nchannels); k++)
+		{
+			v = strtod(p, &end);
+			if (end == p || !isfinite(v) || v < f->lo || v > f->hi || (f->valid && !f->valid(v)))
+			{
+				fprintf(stderr, "vehicleMon: %s: bad %s value %d, using %g\n", path, f->name, k + 1, f->def);
+				rejected++;
+			}
+			else
+			{
+				set_value(f, k, v);
+			}
+
+			p = strchr(p, ',');
+			if (p == NULL)
+			{
+				k++;
+				break;
+			}
+			p++;
+		}
+	}
+
+	free(line);
+	fclose(in);
+	return rejected;
+}
+
+/*
+ * confstore_format:
+ *  Write the fields in settings file form, per-channel values each
+ *  followed by a comma.
+ *********************************************************************************
+ */
+
+void confstore_format (FILE *fp, const struct confstore_field *fields, int n, int nchannels)
+{
+	const struct confstore_field *f;
+	int i, k;
+
+	for (i = 0; i < n; i++)
+	{
+		f = &fields[i];
+		fprintf(fp, "%s%s:\n", i ? "\n" : "", f->name);
+		for (k = 0; k < count_of(f, nchannels); k++)
+		{
+			switch (f->type)
+			{
+			case CONFSTORE_INT:	fprintf(fp, "%d", ((int *)f->values)[k]); break;
+			case CONFSTORE_LONG:	fprintf(fp, "%ld", ((long *)f->values)[k]); break;
+			default:		fprintf(fp, "%lf", ((double *)f->values)[k]); break;
+			}
+			if (f->count == CONFSTORE_PER_CHANNEL)
+			{
+				fputc(',', fp);
+			}
+		}
+	}
+}
+
+static int write_all (int fd, const char *p, size_t n)
+{
+	ssize_t done;
+
+	while (n > 0)
+	{
+		done = write(fd, p, n);
+		if (done < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (done < 0)
+		{
+			return -1;
+		}
+		p += done;
+		n -= done;
+	}
+	return 0;
+}
+
+// write, fsync and rename into place, keeping the old file as path.bak
+static int save (struct confstore *cs, const char *text, size_t length)
+{
+	char trailer[64], dir[CONFSTORE_PATH];
+	int fd, n;
+
+	n = snprintf(trailer, sizeof(trailer), "\nend:\n%lu\n", cs->version + 1);
+
+	fd = open(cs->tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	if (write_all(fd, text, length) < 0 || write_all(fd, trailer, n) < 0 || fsync(fd) < 0)
+	{
+		close(fd);
+		unlink(cs->tmp);
+		return -1;
+	}
+	close(fd);
+
+	if (rename(cs->path, cs->bak) < 0 && errno != ENOENT)
+	{
+		return -1;
+	}
+	if (rename(cs->tmp, cs->path) < 0)
+	{
+		return -1;
+	}
+
+	// make the renames themselves durable
+	snprintf(dir, sizeof(dir), "%s", cs->path);
+	fd = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+	if (fd >= 0)
+	{
+		fsync(fd);
+		close(fd);
+	}
+
+	cs->version++;
+	cs->writes++;
+	return 0;
+}
+
+static void after_ms (struct timespec *t, const struct timespec *from, long ms)
+{
+	*t = *from;
+	t->tv_sec += ms / 1000;
+	t->tv_nsec += (ms % 1000) * 1000000L;
+	if (t->tv_nsec >= 1000000000L)
+	{
+		t->tv_nsec -= 1000000000L;
+		t->tv_sec++;
+	}
+}
+
+/*
+ * confstore_loop:
+ *  The writer thread.  Sleeps until an edit comes in, then until the edits
+ *  stop, and writes the latest copy once for the whole burst.  If the
+ *  write fails the edits stay pending, and it waits out the back-off
+ *  before trying again with whatever is latest then.
+ *********************************************************************************
+ */
+
+static void *confstore_loop (void *data)
+{
+	struct confstore *cs = data;
+	struct timespec first, now, quiet, limit;
+	unsigned long seen, edits;
+	char *text;
+	size_t length;
+	long retry_ms;
+	int err;
+
+	pthread_mutex_lock(&cs->lock);
+	for (;;)
+	{
+		while (cs->saved == cs->edits)
+		{
+			pthread_cond_wait(&cs->changed, &cs->lock);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &first);
+		after_ms(&limit, &first, CONFSTORE_MAX_DELAY_MS);
+		do
+		{
+			seen = cs->edits;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			after_ms(&quiet, &now, CONFSTORE_DEBOUNCE_MS);
+			if (quiet.tv_sec > limit.tv_sec || (quiet.tv_sec == limit.tv_sec && quiet.tv_nsec > limit.tv_nsec))
+			{
+				quiet = limit;
+			}
+			while (cs->edits == seen &&
+					pthread_cond_timedwait(&cs->changed, &cs->lock, &quiet) != ETIMEDOUT)
+				;
+		} while (cs->edits != seen && (now.tv_sec < limit.tv_sec ||
+				(now.tv_sec == limit.tv_sec && now.tv_nsec < limit.tv_nsec)));
+
+		// write outside the lock so updates never wait for the card
+		text = cs->text;
+		length = cs->length;
+		edits = cs->edits;
+		cs->text = NULL;
+		pthread_mutex_unlock(&cs->lock);
+
+		err = save(cs, text, length) < 0 ? errno : 0;
+		if (err)
+		{
+			fprintf(stderr, "vehicleMon: Can't save %s: %s\n", cs->path, strerror(err));
+		}
+
+		pthread_mutex_lock(&cs->lock);
+		if (cs->text == NULL)	// nothing newer came in, keep this copy
+		{
+			cs->text = text;
+		}
+		else
+		{
+			free(text);
+		}
+		cs->tried = edits;
+		cs->error = err;
+		if (err == 0)
+		{
+			cs->saved = edits;
+			cs->failures = 0;
+		}
+		pthread_cond_broadcast(&cs->changed);
+
+		if (err)
+		{
+			retry_ms = CONFSTORE_RETRY_MS << (cs->failures < 6 ? cs->failures : 6);
+			if (retry_ms > CONFSTORE_RETRY_MAX_MS)
+			{
+				retry_ms = CONFSTORE_RETRY_MAX_MS;
+			}
+			cs->failures++;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			after_ms(&quiet, &now, retry_ms);
+			while (pthread_cond_timedwait(&cs->changed, &cs->lock, &quiet) != ETIMEDOUT)
+				;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,83 @@
+#ifndef CONFSTORE_H
+#define CONFSTORE_H
+
+/*
+ * confstore.h:
+ *  Crash-safe, debounced saving of the settings file.  confstore_update()
+ *  only copies the new contents and returns; a writer thread waits until
+ *  the edits have been quiet for the debounce time (or the first one is
+ *  CONFSTORE_MAX_DELAY_MS old) and then writes the latest copy once:
+ *
+ *	path.tmp written, fsync'd, the old file kept as path.bak,
+ *	path.tmp renamed over path, the directory fsync'd
+ *
+ *  A write that fails leaves the edits pending and is tried again after
+ *  CONFSTORE_RETRY_MS, backing off to CONFSTORE_RETRY_MAX_MS.
+ *
+ *  Every file ends with "end:" and a version that goes up by one a write,
+ *  so a file cut short is recognised and confstore_pick() falls back to
+ *  the newest complete one.
+ *
+ *  The contents are described by a table of struct confstore_field, read
+ *  by confstore_load() and written by confstore_format().
+ *********************************************************************************
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define CONFSTORE_DEBOUNCE_MS 500	// quiet time before a burst of edits is written
+#define CONFSTORE_MAX_DELAY_MS 5000	// longest an edit waits, even if edits keep coming
+#define CONFSTORE_RETRY_MS 1000		// wait after a failed write, doubled each failure
+#define CONFSTORE_RETRY_MAX_MS 60000	// up to this
+#define CONFSTORE_PATH 256
+#define CONFSTORE_PER_CHANNEL -1	// count of a field with one value per channel
+
+enum confstore_type
+{
+	CONFSTORE_DOUBLE,
+	CONFSTORE_INT,
+	CONFSTORE_LONG
+};
+
+// one section of the settings file, "name:" then comma separated values
+struct confstore_field
+{
+	const char *name;		// without the colon
+	int type;			// enum confstore_type
+	void *values;			// array of count
+	int count;			// 1 for a single value, or CONFSTORE_PER_CHANNEL
+	double def;			// for a value missing or out of range
+	double lo, hi;			// valid range
+	int (*valid) (double v);	// and a further check within it, or NULL
+};
+
+struct confstore
+{
+	char path[CONFSTORE_PATH];
+	char tmp[CONFSTORE_PATH];
+	char bak[CONFSTORE_PATH];
+	unsigned long version;		// of the newest file on disk
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed;		// an edit came in, or an edit reached the disk
+	pthread_t thread;
+	char *text;			// latest contents, without the end: trailer
+	size_t length;
+	unsigned long edits;		// updates made
+	unsigned long saved;		// of those, the number on disk
+	unsigned long tried;		// the edits the last write attempt held
+	int error;			// errno of the last write, 0 if it worked
+	int failures;			// writes failed in a row
+	long writes;			// files written
+};
+
+int confstore_start (struct confstore *cs, const char *path);
+const char *confstore_pick (struct confstore *cs);
+int confstore_update (struct confstore *cs, const char *text, size_t length);
+int confstore_sync (struct confstore *cs);
+int confstore_load (const char *path, const struct confstore_field *fields, int n, int nchannels);
+void confstore_format (FILE *fp, const struct confstore_field *fields, int n, int nchannels);
+
+#endif /* CONFSTORE_H */
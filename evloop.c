@@ -0,0 +1,179 @@
+/**
+ * 	evloop.c:
+ *
+ *  epoll over inotify on the display's serial port, an eventfd, a timerfd
+ *  and a signalfd, see evloop.h.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+
+#include <pthread.h>
+
+#include "evloop.h"
+
+static int watch (struct evloop *e, int fd, uint32_t events, int tag)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u32 = tag;
+	return epoll_ctl(e->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * evloop_init:
+ *  Set up the descriptors, the serial port device is not watched if NULL
+ *  or if inotify will not watch it.
+ *
+ *  @return: 0 on success or -1 with errno set.
+ *********************************************************************************
+ */
+
+int evloop_init (struct evloop *e, const char *device)
+{
+	e->notifyfd = -1;
+	e->signalfd = -1;
+	sigemptyset(&e->signals);
+	e->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	e->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	e->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (e->wakefd < 0 || e->timerfd < 0 || e->epfd < 0)
+	{
+		return -1;
+	}
+
+	if (watch(e, e->wakefd, EPOLLIN, EVLOOP_WAKE) < 0 || watch(e, e->timerfd, EPOLLIN, EVLOOP_TIMER) < 0)
+	{
+		return -1;
+	}
+	if (device == NULL)
+	{
+		return 0;
+	}
+
+	e->notifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (e->notifyfd >= 0 && (inotify_add_watch(e->notifyfd, device, IN_ACCESS) < 0 ||
+			watch(e, e->notifyfd, EPOLLIN, EVLOOP_SERIAL) < 0))
+	{
+		close(e->notifyfd);
+		e->notifyfd = -1;
+	}
+	return 0;
+}
+
+/*
+ * evloop_signal:
+ *  Have signo wake the loop instead of interrupting whichever thread it
+ *  lands on.  It is blocked in the calling thread, so call this before
+ *  starting any other thread for them to block it too.
+ *
+ *  @return: 0 on success or -1 with errno set.
+ *********************************************************************************
+ */
+
+int evloop_signal (struct evloop *e, int signo)
+{
+	int first = e->signalfd < 0;
+
+	sigaddset(&e->signals, signo);
+	if (pthread_sigmask(SIG_BLOCK, &e->signals, NULL) != 0)
+	{
+		return -1;
+	}
+
+	e->signalfd = signalfd(e->signalfd, &e->signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (e->signalfd < 0)
+	{
+		return -1;
+	}
+	return first ? watch(e, e->signalfd, EPOLLIN, EVLOOP_SIGNAL) : 0;
+}
+
+// may be called from any thread
+void evloop_wake (struct evloop *e)
+{
+	uint64_t one = 1;
+
+	if (write(e->wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+	{
+		fprintf(stderr, "vehicleMon: Can't wake main loop: %s\n", strerror(errno));
+	}
+}
+
+/*
+ * evloop_timer:
+ *  Set the deadline to the CLOCK_MONOTONIC time at_ns, replacing the last
+ *  one.  0 clears it.
+ *********************************************************************************
+ */
+
+void evloop_timer (struct evloop *e, int64_t at_ns)
+{
+	struct itimerspec t;
+
+	memset(&t, 0, sizeof(t));
+	t.it_value.tv_sec = at_ns / 1000000000LL;
+	t.it_value.tv_nsec = at_ns % 1000000000LL;
+	timerfd_settime(e->timerfd, TFD_TIMER_ABSTIME, &t, NULL);
+}
+
+/*
+ * evloop_wait:
+ *  Sleep until something is ready.
+ *
+ *  @return: the EVLOOP_ flags of what is, or -1 on an error other than a
+ *  signal.
+ *********************************************************************************
+ */
+
+int evloop_wait (struct evloop *e)
+{
+	struct epoll_event ev[4];
+	struct signalfd_siginfo info;
+	char notices[256];
+	uint64_t count;
+	int i, n, ready = 0;
+
+	n = epoll_wait(e->epfd, ev, 4, -1);
+	if (n < 0)
+	{
+		return errno == EINTR ? 0 : -1;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		ready |= ev[i].data.u32;
+	}
+
+	// reset the counters so they are only ready again for new events
+	if (ready & EVLOOP_WAKE)
+	{
+		read(e->wakefd, &count, sizeof(count));
+	}
+	if (ready & EVLOOP_TIMER)
+	{
+		read(e->timerfd, &count, sizeof(count));
+	}
+	if (ready & EVLOOP_SERIAL)
+	{
+		while (read(e->notifyfd, notices, sizeof(notices)) > 0)
+			;
+	}
+	if (ready & EVLOOP_SIGNAL)
+	{
+		while (read(e->signalfd, &info, sizeof(info)) > 0)
+			;
+	}
+	return ready;
+}
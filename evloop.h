@@ -0,0 +1,45 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+/*
+ * evloop.h:
+ *  What the main thread sleeps on: the display's serial port, an eventfd
+ *  other threads write to when they have something for it, a timerfd for
+ *  its own deadlines and a signalfd for the signals given to
+ *  evloop_signal().  evloop_wait() blocks until one of them is ready
+ *  and says which.
+ *
+ *  The serial port is read by geniePi's own thread, which takes the bytes
+ *  before a poll on the port could report them, so the port is watched
+ *  with inotify instead: every read geniePi makes from it is reported, and
+ *  a reply it has just read is on its queue a moment later.  If the port
+ *  cannot be watched, notifyfd is left at -1 and EVLOOP_SERIAL never comes
+ *  up; the caller has to poll for replies on its timer instead.
+ *********************************************************************************
+ */
+
+#include <stdint.h>
+#include <signal.h>
+
+#define EVLOOP_SERIAL	1	// geniePi read from the display
+#define EVLOOP_WAKE	2	// evloop_wake() was called
+#define EVLOOP_TIMER	4	// the evloop_timer() deadline passed
+#define EVLOOP_SIGNAL	8	// one of the evloop_signal() signals came in
+
+struct evloop
+{
+	int epfd;
+	int wakefd;			// eventfd
+	int timerfd;			// CLOCK_MONOTONIC
+	int notifyfd;			// inotify on the serial port, -1 if not watched
+	int signalfd;			// -1 until evloop_signal()
+	sigset_t signals;
+};
+
+int evloop_init (struct evloop *e, const char *device);
+int evloop_signal (struct evloop *e, int signo);
+void evloop_wake (struct evloop *e);
+void evloop_timer (struct evloop *e, int64_t at_ns);
+int evloop_wait (struct evloop *e);
+
+#endif /* EVLOOP_H */
@@ -0,0 +1,274 @@
+/**
+ * 	genieq.c:
+ *
+ *  Single writer for the Genie display.  Any thread may queue commands; the
+ *  writer thread sends them one at a time through geniePi, highest priority
+ *  first and in order within a priority, waiting for each ACK as before.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <geniePi.h>
+
+#include "genieq.h"
+#include "clockns.h"
+
+static void *genieq_loop (void *data);
+
+/*
+ * genieq_start:
+ *  Start the writer thread.  sent, if not NULL, is called by the writer
+ *  after each write; it is fixed here as the writer reads it unlocked.
+ *
+ *  @return: 0 on success or -1.
+ *********************************************************************************
+ */
+
+int genieq_start (struct genieq *q, void (*sent) (const struct genieq_cmd *c, int64_t sent_ns))
+{
+	memset(q, 0, sizeof(*q));
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->ready, NULL);
+	q->sent = sent;
+	q->running = 1;
+
+	if (pthread_create(&q->thread, NULL, genieq_loop, q) != 0)
+	{
+		q->running = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * genieq_stop:
+ *  Send what is still queued, then stop the writer thread.
+ *********************************************************************************
+ */
+
+void genieq_stop (struct genieq *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->running = 0;
+	pthread_cond_signal(&q->ready);
+	pthread_mutex_unlock(&q->lock);
+	pthread_join(q->thread, NULL);
+}
+
+// a new write makes a waiting one pointless: the same string, the same
+// object value, or any form change.  Scope writes each add a point, never.
+static int supersedes (const struct genieq_cmd *c, const struct genieq_cmd *waiting)
+{
+	if (c->cmd != waiting->cmd)
+	{
+		return 0;
+	}
+	if (c->cmd == GENIE_WRITE_STR)
+	{
+		return c->index == waiting->index;
+	}
+	if (c->object != waiting->object || c->object == GENIE_OBJ_SCOPE)
+	{
+		return 0;
+	}
+	return c->object == GENIE_OBJ_FORM || c->index == waiting->index;
+}
+
+static int queue (struct genieq *q, int priority, const struct genieq_cmd *c)
+{
+	struct genieq_stats *st;
+	unsigned int i;
+
+	if (priority < 0 || priority >= GENIEQ_PRIORITIES)
+	{
+		priority = GENIEQ_NORMAL;
+	}
+	st = &q->stats[priority];
+
+	pthread_mutex_lock(&q->lock);
+	st->queued++;
+
+	for (i = q->head[priority]; i != q->tail[priority]; i++)
+	{
+		if (supersedes(c, &q->cmd[priority][i & (GENIEQ_LENGTH - 1)]))
+		{
+			q->cmd[priority][i & (GENIEQ_LENGTH - 1)] = *c;
+			st->merged++;
+			pthread_mutex_unlock(&q->lock);
+			return 0;
+		}
+	}
+
+	if (q->tail[priority] - q->head[priority] == GENIEQ_LENGTH)
+	{
+		st->dropped++;
+		pthread_mutex_unlock(&q->lock);
+		return -1;
+	}
+
+	q->cmd[priority][q->tail[priority]++ & (GENIEQ_LENGTH - 1)] = *c;
+	pthread_cond_signal(&q->ready);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+/*
+ * genieq_obj, genieq_str:
+ *  Queue genieWriteObj and genieWriteStr.  The _from versions also say
+ *  which channel's sample the write shows, and when its conversion was
+ *  requested, for the sent callback.
+ *
+ *  @return: 0 if queued or merged, -1 if that priority's queue is full.
+ *********************************************************************************
+ */
+
+int genieq_obj_from (struct genieq *q, int priority, int object, int index, int data,
+		int channel, int64_t origin_ns)
+{
+	struct genieq_cmd c;
+
+	c.cmd = GENIE_WRITE_OBJ;
+	c.object = object;
+	c.index = index;
+	c.data = data;
+	c.text[0] = '\0';
+	c.channel = channel;
+	c.origin_ns = origin_ns;
+	c.queued_ns = clock_ns(CLOCK_MONOTONIC);
+	return queue(q, priority, &c);
+}
+
+int genieq_str_from (struct genieq *q, int priority, int index, const char *text,
+		int channel, int64_t origin_ns)
+{
+	struct genieq_cmd c;
+
+	c.cmd = GENIE_WRITE_STR;
+	c.object = GENIE_OBJ_STRINGS;
+	c.index = index;
+	c.data = 0;
+	strncpy(c.text, text, GENIEQ_TEXT - 1);
+	c.text[GENIEQ_TEXT - 1] = '\0';
+	c.channel = channel;
+	c.origin_ns = origin_ns;
+	c.queued_ns = clock_ns(CLOCK_MONOTONIC);
+	return queue(q, priority, &c);
+}
+
+int genieq_obj (struct genieq *q, int priority, int object, int index, int data)
+{
+	return genieq_obj_from(q, priority, object, index, data, -1, 0);
+}
+
+int genieq_str (struct genieq *q, int priority, int index, const char *text)
+{
+	return genieq_str_from(q, priority, index, text, -1, 0);
+}
+
+/*
+ * genieq_points:
+ *  Queue n writes to one object that must not be split, such as a point for
+ *  each trace of a scope: either all of them are queued or none.
+ *
+ *  @return: 0 if queued or -1 if there is no room for them all.
+ *********************************************************************************
+ */
+
+int genieq_points (struct genieq *q, int priority, int object, int index, const int *values, int n)
+{
+	struct genieq_cmd *c;
+	int64_t now = clock_ns(CLOCK_MONOTONIC);
+	int i;
+
+	if (priority < 0 || priority >= GENIEQ_PRIORITIES)
+	{
+		priority = GENIEQ_NORMAL;
+	}
+
+	pthread_mutex_lock(&q->lock);
+	q->stats[priority].queued += n;
+	if (q->tail[priority] - q->head[priority] + n > GENIEQ_LENGTH)
+	{
+		q->stats[priority].dropped += n;
+		pthread_mutex_unlock(&q->lock);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		c = &q->cmd[priority][q->tail[priority]++ & (GENIEQ_LENGTH - 1)];
+		c->cmd = GENIE_WRITE_OBJ;
+		c->object = object;
+		c->index = index;
+		c->data = values[i];
+		c->text[0] = '\0';
+		c->channel = -1;
+		c->origin_ns = 0;
+		c->queued_ns = now;
+	}
+	pthread_cond_signal(&q->ready);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+/*
+ * genieq_loop:
+ *  The writer thread.  The lock is dropped while a frame is on the wire, so
+ *  queueing never waits for the UART.
+ *********************************************************************************
+ */
+
+static void *genieq_loop (void *data)
+{
+	struct genieq *q = data;
+	struct genieq_cmd c;
+	int i;
+
+	pthread_mutex_lock(&q->lock);
+	for (;;)
+	{
+		for (i = 0; i < GENIEQ_PRIORITIES; i++)
+		{
+			if (q->head[i] != q->tail[i])
+			{
+				break;
+			}
+		}
+
+		if (i == GENIEQ_PRIORITIES)
+		{
+			if (!q->running)
+			{
+				break;
+			}
+			pthread_cond_wait(&q->ready, &q->lock);
+			continue;
+		}
+
+		c = q->cmd[i][q->head[i]++ & (GENIEQ_LENGTH - 1)];
+		q->stats[i].sent++;
+		pthread_mutex_unlock(&q->lock);
+
+		if (c.cmd == GENIE_WRITE_STR)
+		{
+			genieWriteStr(c.index, c.text);
+		}
+		else
+		{
+			genieWriteObj(c.object, c.index, c.data);
+		}
+		if (q->sent)
+		{
+			q->sent(&c, clock_ns(CLOCK_MONOTONIC));
+		}
+
+		pthread_mutex_lock(&q->lock);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
@@ -0,0 +1,71 @@
+#ifndef GENIEQ_H
+#define GENIEQ_H
+
+/*
+ * genieq.h:
+ *  One queue for everything sent to the display, emptied by a single writer
+ *  thread so frames from different threads can never interleave on the
+ *  UART.  A write to an object that is still waiting replaces the pending
+ *  value instead of queueing behind it, and urgent commands (alarm sounds,
+ *  form changes) go out before touch replies, which go before routine
+ *  readings.
+ *********************************************************************************
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define GENIEQ_LENGTH 64		// pending commands per priority, a power of 2
+#define GENIEQ_TEXT 64			// longest string queued
+
+enum genieq_priority
+{
+	GENIEQ_URGENT,			// alarm sounds and form changes
+	GENIEQ_NORMAL,			// replies to touches
+	GENIEQ_ROUTINE,			// readings and scope points
+	GENIEQ_PRIORITIES
+};
+
+struct genieq_cmd
+{
+	int cmd;			// GENIE_WRITE_OBJ or GENIE_WRITE_STR
+	int object;
+	int index;
+	int data;
+	char text[GENIEQ_TEXT];
+	int channel;			// whose sample the write shows, -1 if none
+	int64_t origin_ns;		// when that sample's conversion was requested
+	int64_t queued_ns;		// CLOCK_MONOTONIC
+};
+
+struct genieq_stats
+{
+	long queued;
+	long sent;
+	long merged;			// replaced a write still waiting
+	long dropped;			// queue full
+};
+
+struct genieq
+{
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_t thread;
+	int running;
+	struct genieq_cmd cmd[GENIEQ_PRIORITIES][GENIEQ_LENGTH];
+	unsigned int head[GENIEQ_PRIORITIES], tail[GENIEQ_PRIORITIES];
+	struct genieq_stats stats[GENIEQ_PRIORITIES];
+	void (*sent) (const struct genieq_cmd *c, int64_t sent_ns);	// after each write, may be NULL
+};
+
+int genieq_start (struct genieq *q, void (*sent) (const struct genieq_cmd *c, int64_t sent_ns));
+void genieq_stop (struct genieq *q);
+int genieq_obj (struct genieq *q, int priority, int object, int index, int data);
+int genieq_str (struct genieq *q, int priority, int index, const char *text);
+int genieq_obj_from (struct genieq *q, int priority, int object, int index, int data,
+		int channel, int64_t origin_ns);
+int genieq_str_from (struct genieq *q, int priority, int index, const char *text,
+		int channel, int64_t origin_ns);
+int genieq_points (struct genieq *q, int priority, int object, int index, const int *values, int n);
+
+#endif /* GENIEQ_H */
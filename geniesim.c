@@ -0,0 +1,292 @@
+/**
+ * 	geniesim.c:
+ *
+ *  Pseudo-terminal stand-in for the uLCD-28PTU running ViSi-Genie.
+ *  Frames from the host are checked, acknowledged and handed to a callback;
+ *  object reads are answered with 0 and touch events are written back as
+ *  GENIE_REPORT_EVENT frames.
+ ***********************************************************************
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <pthread.h>
+
+#include <geniePi.h>
+
+#include "geniesim.h"
+
+static void *geniesim_loop (void *data);
+
+/*
+ * geniesim_open:
+ *  Create the pty, optionally symlinked to a fixed path.
+ *
+ *  @return: 0 on success or -1 with errno set.
+ *********************************************************************************
+ */
+
+int geniesim_open (struct geniesim *g, const char *link)
+{
+	struct termios options;
+
+	memset(g, 0, sizeof(*g));
+	g->slave = -1;
+
+	g->master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (g->master < 0)
+	{
+		return -1;
+	}
+
+	if (grantpt(g->master) < 0 || unlockpt(g->master) < 0)
+	{
+		close(g->master);
+		return -1;
+	}
+
+	strncpy(g->device, ptsname(g->master), sizeof(g->device) - 1);
+
+	// raw, so the protocol bytes pass untouched until the host sets its own mode
+	g->slave = open(g->device, O_RDWR | O_NOCTTY);
+	if (g->slave >= 0 && tcgetattr(g->slave, &options) == 0)
+	{
+		cfmakeraw(&options);
+		tcsetattr(g->slave, TCSANOW, &options);
+	}
+
+	if (link)
+	{
+		unlink(link);
+		if (symlink(g->device, link) < 0)
+		{
+			geniesim_close(g);
+			return -1;
+		}
+		strncpy(g->device, link, sizeof(g->device) - 1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &g->started);
+	return 0;
+}
+
+int geniesim_start (struct geniesim *g)
+{
+	return pthread_create(&g->thread, NULL, geniesim_loop, g) == 0 ? 0 : -1;
+}
+
+void geniesim_close (struct geniesim *g)
+{
+	if (g->thread)
+	{
+		pthread_cancel(g->thread);
+		pthread_join(g->thread, NULL);
+		g->thread = 0;
+	}
+	if (g->slave >= 0)
+	{
+		close(g->slave);
+	}
+	if (g->master >= 0)
+	{
+		close(g->master);
+	}
+	g->slave = g->master = -1;
+}
+
+/*
+ * geniesim_inject:
+ *  Send a touch event to the host, as if a widget had been pressed.
+ *********************************************************************************
+ */
+
+int geniesim_inject (struct geniesim *g, int object, int index, unsigned int data)
+{
+	unsigned char frame[6];
+
+	frame[0] = GENIE_REPORT_EVENT;
+	frame[1] = object;
+	frame[2] = index;
+	frame[3] = (data >> 8) & 0xFF;
+	frame[4] = data & 0xFF;
+	frame[5] = frame[0] ^ frame[1] ^ frame[2] ^ frame[3] ^ frame[4];
+
+	if (write(g->master, frame, sizeof(frame)) != sizeof(frame))
+	{
+		return -1;
+	}
+	__sync_fetch_and_add(&g->events, 1);
+	return 0;
+}
+
+const char *geniesim_cmd_name (int cmd)
+{
+	switch (cmd)
+	{
+	case GENIE_READ_OBJ:		return "READ_OBJ";
+	case GENIE_WRITE_OBJ:		return "WRITE_OBJ";
+	case GENIE_WRITE_STR:		return "WRITE_STR";
+	case GENIE_WRITE_STRU:		return "WRITE_STRU";
+	case GENIE_WRITE_CONTRAST:	return "WRITE_CONTRAST";
+	default:			return "UNKNOWN";
+	}
+}
+
+static int read_byte (struct geniesim *g, unsigned char *c)
+{
+	int n;
+
+	do
+	{
+		n = read(g->master, c, 1);
+	} while (n < 0 && errno == EINTR);
+
+	// EIO only means no host has the slave open, keep waiting for one
+	if (n < 0 && errno == EIO)
+	{
+		usleep(10000);
+		return 0;
+	}
+	return n;
+}
+
+static int read_bytes (struct geniesim *g, unsigned char *buf, int len)
+{
+	int i, n;
+
+	for (i = 0; i < len; i += n)
+	{
+		n = read_byte(g, buf + i);
+		if (n < 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * geniesim_loop:
+ *  Frame the byte stream from the host, ACK or NAK each frame.
+ *********************************************************************************
+ */
+
+static void *geniesim_loop (void *data)
+{
+	struct geniesim *g = data;
+	struct geniesim_frame f;
+	unsigned char buf[GENIESIM_MAX_FRAME];
+	unsigned char sum, reply[6];
+	int i, len, n;
+
+	for (;;)
+	{
+		n = read_byte(g, buf);
+		if (n < 0)
+		{
+			break;
+		}
+		if (n == 0)
+		{
+			continue;
+		}
+
+		memset(&f, 0, sizeof(f));
+		f.cmd = buf[0];
+
+		// work out the length of the rest of the frame from its command
+		switch (f.cmd)
+		{
+		case GENIE_READ_OBJ:		len = 4; break;
+		case GENIE_WRITE_OBJ:		len = 6; break;
+		case GENIE_WRITE_CONTRAST:	len = 3; break;
+		case GENIE_WRITE_STR:
+		case GENIE_WRITE_STRU:
+			if (read_bytes(g, buf + 1, 2) < 0)
+			{
+				return NULL;
+			}
+			len = 3 + buf[2] * (f.cmd == GENIE_WRITE_STRU ? 2 : 1) + 1;
+			break;
+		default:
+			__sync_fetch_and_add(&g->errors, 1);
+			continue;
+		}
+
+		i = f.cmd == GENIE_WRITE_STR || f.cmd == GENIE_WRITE_STRU ? 3 : 1;
+		if (read_bytes(g, buf + i, len - i) < 0)
+		{
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &f.when);
+
+		sum = 0;
+		for (i = 0; i < len; i++)
+		{
+			sum ^= buf[i];
+		}
+
+		f.length = len;
+		__sync_fetch_and_add(&g->frames, 1);
+		__sync_fetch_and_add(&g->bytes, len);
+
+		if (sum != 0)
+		{
+			__sync_fetch_and_add(&g->errors, 1);
+			reply[0] = GENIE_NAK;
+			write(g->master, reply, 1);
+			continue;
+		}
+
+		switch (f.cmd)
+		{
+		case GENIE_READ_OBJ:
+			f.object = buf[1];
+			f.index = buf[2];
+			reply[0] = GENIE_REPORT_OBJ;
+			reply[1] = f.object;
+			reply[2] = f.index;
+			reply[3] = 0;
+			reply[4] = 0;
+			reply[5] = reply[0] ^ reply[1] ^ reply[2];
+			write(g->master, reply, 6);
+			break;
+		case GENIE_WRITE_OBJ:
+			f.object = buf[1];
+			f.index = buf[2];
+			f.data = (buf[3] << 8) | buf[4];
+			break;
+		case GENIE_WRITE_CONTRAST:
+			f.data = buf[1];
+			break;
+		default:
+			f.index = buf[1];
+			memcpy(f.str, buf + 3, len - 4);
+			f.str[len - 4] = '\0';
+			break;
+		}
+
+		if (f.cmd != GENIE_READ_OBJ)
+		{
+			reply[0] = GENIE_ACK;
+			write(g->master, reply, 1);
+		}
+
+		if (g->on_frame)
+		{
+			g->on_frame(g, &f, g->arg);
+		}
+	}
+
+	return NULL;
+}
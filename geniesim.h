@@ -0,0 +1,56 @@
+#ifndef GENIESIM_H
+#define GENIESIM_H
+
+/*
+ * geniesim.h:
+ *  A stand-in for the 4D Systems display that speaks the ViSi-Genie serial
+ *  protocol on a pseudo-terminal.  vehicleMon opens the slave side as if it
+ *  were /dev/ttyAMA0; every frame it sends is acknowledged, timestamped and
+ *  passed to a callback, and touch events can be injected the other way.
+ *********************************************************************************
+ */
+
+#include <pthread.h>
+#include <time.h>
+
+// the longest frame, GENIE_WRITE_STRU of 255 characters: command, index,
+// length, two bytes a character and the checksum
+#define GENIESIM_MAX_FRAME (3 + 2 * 255 + 1)
+
+struct geniesim_frame
+{
+	struct timespec when;	// CLOCK_MONOTONIC, when the last byte arrived
+	int cmd;		// GENIE_WRITE_OBJ, GENIE_WRITE_STR, ...
+	int object;		// for object commands
+	int index;
+	unsigned int data;	// object value
+	char str[GENIESIM_MAX_FRAME];	// for string commands
+	int length;		// bytes on the wire including checksum
+};
+
+struct geniesim
+{
+	int master;		// pty master, our side of the serial line
+	int slave;		// kept open so the pty survives reconnects
+	char device[64];	// slave path for genieSetup()
+	pthread_t thread;
+	struct timespec started;
+
+	// called from the sim thread for every complete frame
+	void (*on_frame) (struct geniesim *g, const struct geniesim_frame *f, void *arg);
+	void *arg;
+
+	// totals, updated by the sim thread
+	long frames;
+	long bytes;
+	long errors;		// bad checksums or unknown commands
+	long events;		// touch events injected
+};
+
+int geniesim_open (struct geniesim *g, const char *link);
+int geniesim_start (struct geniesim *g);
+void geniesim_close (struct geniesim *g);
+int geniesim_inject (struct geniesim *g, int object, int index, unsigned int data);
+const char *geniesim_cmd_name (int cmd);
+
+#endif /* GENIESIM_H */
@@ -0,0 +1,156 @@
+/**
+ * 	latency.c:
+ *
+ *  Lock-free latency histograms, see latency.h.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency.h"
+
+static const char *stage_name[LATENCY_STAGES] =
+{
+	"conversion", "calibration", "alarm", "notify", "write", "alarm_total", "reading_total"
+};
+
+int latency_init (struct latency *l, int nchannels)
+{
+	l->nchannels = nchannels;
+	l->count = calloc((size_t)LATENCY_STAGES * nchannels * LATENCY_BUCKETS, sizeof(uint64_t));
+	return l->count ? 0 : -1;
+}
+
+static int bucket_of (int64_t ns)
+{
+	int msb, b;
+
+	if (ns < 4)
+	{
+		return ns < 0 ? 0 : ns;
+	}
+	msb = 63 - __builtin_clzll(ns);
+	b = 4 * (msb - 1) + ((ns >> (msb - 2)) & 3);
+	return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1;
+}
+
+// the first time past bucket b
+static int64_t bucket_top (int b)
+{
+	if (b < 4)
+	{
+		return b + 1;
+	}
+	return (int64_t)(5 + b % 4) << (b / 4 - 1);
+}
+
+static uint64_t *histogram (struct latency *l, int stage, int channel)
+{
+	return l->count + ((size_t)stage * l->nchannels + channel) * LATENCY_BUCKETS;
+}
+
+/*
+ * latency_add:
+ *  Count one time of ns for the stage on channel.  Does nothing before
+ *  latency_init() or for a channel out of range.
+ *********************************************************************************
+ */
+
+void latency_add (struct latency *l, int stage, int channel, int64_t ns)
+{
+	if (l->count == NULL || channel < 0 || channel >= l->nchannels)
+	{
+		return;
+	}
+	__atomic_fetch_add(&histogram(l, stage, channel)[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * latency_quantile:
+ *  The time q (0 to 1) of the stage's times on channel were within, or of
+ *  all channels for channel -1.  samples is set to the number counted.
+ *
+ *  @return: the time in ns, 0 if nothing has been counted.
+ *********************************************************************************
+ */
+
+int64_t latency_quantile (struct latency *l, int stage, int channel, double q, uint64_t *samples)
+{
+	uint64_t sum[LATENCY_BUCKETS] = { 0 };
+	uint64_t total = 0, need, seen = 0;
+	int c, b;
+
+	for (c = 0; c < l->nchannels; c++)
+	{
+		if (channel >= 0 && c != channel)
+		{
+			continue;
+		}
+		for (b = 0; b < LATENCY_BUCKETS; b++)
+		{
+			sum[b] += __atomic_load_n(&histogram(l, stage, c)[b], __ATOMIC_RELAXED);
+		}
+	}
+	for (b = 0; b < LATENCY_BUCKETS; b++)
+	{
+		total += sum[b];
+	}
+
+	*samples = total;
+	if (total == 0)
+	{
+		return 0;
+	}
+
+	need = (uint64_t)(q * total);
+	need = need < 1 ? 1 : need;
+	for (b = 0; b < LATENCY_BUCKETS; b++)
+	{
+		seen += sum[b];
+		if (seen >= need)
+		{
+			break;
+		}
+	}
+	return bucket_top(b);
+}
+
+/*
+ * latency_report:
+ *  Write count, p50, p99 and p99.9 in microseconds for every stage, for
+ *  all channels and then each channel that has anything counted.
+ *********************************************************************************
+ */
+
+void latency_report (struct latency *l, FILE *fp)
+{
+	int s, c;
+	uint64_t n;
+	int64_t p50, p99, p999;
+
+	fprintf(fp, "stage,channel,samples,p50_us,p99_us,p99.9_us\n");
+	for (s = 0; s < LATENCY_STAGES; s++)
+	{
+		for (c = -1; c < l->nchannels; c++)
+		{
+			p50 = latency_quantile(l, s, c, 0.5, &n);
+			p99 = latency_quantile(l, s, c, 0.99, &n);
+			p999 = latency_quantile(l, s, c, 0.999, &n);
+			if (n == 0)
+			{
+				continue;
+			}
+			if (c < 0)
+			{
+				fprintf(fp, "%s,all,", stage_name[s]);
+			}
+			else
+			{
+				fprintf(fp, "%s,%d,", stage_name[s], c + 1);
+			}
+			fprintf(fp, "%llu,%.1f,%.1f,%.1f\n", (unsigned long long)n, p50 / 1e3, p99 / 1e3, p999 / 1e3);
+		}
+	}
+}
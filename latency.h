@@ -0,0 +1,45 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/*
+ * latency.h:
+ *  Histograms of how long each stage between a conversion and the display
+ *  takes, per channel.  Any thread may add to them without a lock, each
+ *  add is one relaxed atomic increment; reading them while they are being
+ *  added to gives counts that are at most a few samples out.
+ *
+ *  Buckets are four to a power of two of nanoseconds, from 1 ns up to
+ *  about 18 minutes, and a quantile is given as the top of its bucket so
+ *  it is never under and at most 25% over.
+ *********************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LATENCY_BUCKETS 160		// 4 per power of two up to 2^40 ns
+
+enum latency_stage
+{
+	LATENCY_CONVERSION,		// conversion requested to ready bit seen
+	LATENCY_CALIBRATION,		// ready bit to calibrated value
+	LATENCY_ALARM,			// calibrated value to alarm decided
+	LATENCY_NOTIFY,			// alarm tripped to its sound queued for the display
+	LATENCY_WRITE,			// queued for the display to frame written
+	LATENCY_ALARM_TOTAL,		// conversion requested to alarm sound written
+	LATENCY_READING_TOTAL,		// conversion requested to reading written
+	LATENCY_STAGES
+};
+
+struct latency
+{
+	int nchannels;
+	uint64_t *count;		// [stage][channel][bucket]
+};
+
+int latency_init (struct latency *l, int nchannels);
+void latency_add (struct latency *l, int stage, int channel, int64_t ns);
+int64_t latency_quantile (struct latency *l, int stage, int channel, double q, uint64_t *samples);
+void latency_report (struct latency *l, FILE *fp);
+
+#endif /* LATENCY_H */
@@ -0,0 +1,228 @@
+/**
+ * 	liveboard.c:
+ *
+ *  Shared memory live value board, see liveboard.h.  Only the read thread
+ *  publishes; any number of processes may read.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "liveboard.h"
+#include "clockns.h"
+
+static int map (struct liveboard *b, int prot)
+{
+	char *m = mmap(NULL, b->length, prot, MAP_SHARED, b->fd, 0);
+
+	if (m == MAP_FAILED)
+	{
+		return -1;
+	}
+	b->header = (struct liveboard_header *)m;
+	b->channel = (struct liveboard_channel *)(m + sizeof(struct liveboard_header));
+	return 0;
+}
+
+static void fail (struct liveboard *b)
+{
+	int err = errno;
+
+	if (b->fd >= 0)
+	{
+		close(b->fd);
+	}
+	memset(b, 0, sizeof(*b));
+	b->fd = -1;
+	errno = err;
+}
+
+/*
+ * liveboard_create:
+ *  Create the segment called name, or take over the one a previous run
+ *  left, and clear it for nchannels.  The segment is grown if need be but
+ *  never shrunk, so readers already attached to an old one carry on with
+ *  the new values of the channels they mapped.
+ *
+ *  @return: 0 on success or -1 with errno set.
+ *********************************************************************************
+ */
+
+int liveboard_create (struct liveboard *b, const char *name, int nchannels)
+{
+	struct stat st;
+
+	memset(b, 0, sizeof(*b));
+	b->length = sizeof(struct liveboard_header) + nchannels * sizeof(struct liveboard_channel);
+	b->nchannels = nchannels;
+	b->writable = 1;
+
+	// a reader of a larger old segment would fault on the pages cut off
+	b->fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if (b->fd < 0 || fstat(b->fd, &st) < 0 ||
+			((size_t)st.st_size < b->length && ftruncate(b->fd, b->length) < 0) ||
+			map(b, PROT_READ | PROT_WRITE) < 0)
+	{
+		fail(b);
+		return -1;
+	}
+
+	memset(b->header, 0, b->length);
+	b->header->version = LIVEBOARD_VERSION;
+	b->header->channel_size = sizeof(struct liveboard_channel);
+	b->header->nchannels = nchannels;
+	b->header->pid = getpid();
+	b->header->offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+
+	// the magic goes in last, a reader never sees half a header
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(b->header->magic, LIVEBOARD_MAGIC, sizeof(LIVEBOARD_MAGIC));
+	return 0;
+}
+
+/*
+ * liveboard_attach:
+ *  Map the segment called name read only, for a reader.
+ *
+ *  @return: 0 on success or -1 with errno set, EPROTO if it is not a
+ *  board this reader understands.
+ *********************************************************************************
+ */
+
+int liveboard_attach (struct liveboard *b, const char *name)
+{
+	struct stat st;
+
+	memset(b, 0, sizeof(*b));
+	b->fd = shm_open(name, O_RDONLY, 0);
+	if (b->fd < 0 || fstat(b->fd, &st) < 0)
+	{
+		fail(b);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(struct liveboard_header))
+	{
+		errno = EPROTO;
+		fail(b);
+		return -1;
+	}
+
+	b->length = st.st_size;
+	if (map(b, PROT_READ) < 0)
+	{
+		fail(b);
+		return -1;
+	}
+
+	// the magic first, then the fields the writer put in before it
+	if (memcmp(b->header->magic, LIVEBOARD_MAGIC, sizeof(LIVEBOARD_MAGIC)) != 0)
+	{
+		goto bad;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	b->nchannels = b->header->nchannels;
+	if (b->header->version != LIVEBOARD_VERSION ||
+			b->header->channel_size != sizeof(struct liveboard_channel) ||
+			b->nchannels < 0 ||
+			b->length < sizeof(struct liveboard_header) + b->nchannels * sizeof(struct liveboard_channel))
+	{
+		goto bad;
+	}
+	return 0;
+
+bad:
+	munmap(b->header, b->length);
+	errno = EPROTO;
+	fail(b);
+	return -1;
+}
+
+// the segment itself is left for readers still attached and the next run
+void liveboard_close (struct liveboard *b)
+{
+	if (b->header)
+	{
+		munmap(b->header, b->length);
+	}
+	if (b->fd >= 0)
+	{
+		close(b->fd);
+	}
+	memset(b, 0, sizeof(*b));
+	b->fd = -1;
+}
+
+/*
+ * liveboard_publish:
+ *  Store a channel's latest sample and alarm state.  Does nothing if the
+ *  board is not open for writing.
+ *********************************************************************************
+ */
+
+void liveboard_publish (struct liveboard *b, int channel, int64_t t_ns, int code,
+		float true_voltage, double value, int alarm)
+{
+	struct liveboard_channel *c;
+	uint32_t seq;
+
+	if (!b->writable || channel < 0 || channel >= b->nchannels)
+	{
+		return;
+	}
+
+	c = &b->channel[channel];
+	seq = c->seq;
+	__atomic_store_n(&c->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	c->alarm = alarm;
+	c->t_ns = t_ns;
+	c->code = code;
+	c->true_voltage = true_voltage;
+	c->value = value;
+	c->samples++;
+	__atomic_store_n(&c->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * liveboard_read:
+ *  Copy a channel out whole, trying again while it is being written.
+ *  Only the channels there were when the board was attached are read.
+ *
+ *  @return: 0, or -1 if the channel is out of range or has no sample yet.
+ *********************************************************************************
+ */
+
+int liveboard_read (const struct liveboard *b, int channel, struct liveboard_channel *out)
+{
+	const struct liveboard_channel *c;
+	uint32_t before, after;
+
+	if (b->header == NULL || channel < 0 || channel >= b->nchannels)
+	{
+		return -1;
+	}
+
+	c = &b->channel[channel];
+	do
+	{
+		before = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		if (before & 1)
+		{
+			after = before + 1;	// being written, try again
+			continue;
+		}
+		memcpy(out, c, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+	}
+	while (before != after);
+
+	return before == 0 ? -1 : 0;
+}
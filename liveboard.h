@@ -0,0 +1,66 @@
+#ifndef LIVEBOARD_H
+#define LIVEBOARD_H
+
+/*
+ * liveboard.h:
+ *  Live value board: the latest sample, its time and the alarm state of
+ *  every channel, published in a POSIX shared memory segment for other
+ *  processes on the box.  Each channel has its own seqlock, so the read
+ *  thread only ever makes a few stores to update it and never waits for
+ *  a reader; readers copy a channel out and try again if it changed while
+ *  they were copying, with no system call and no lock.
+ *
+ *  The segment is a liveboard_header followed by nchannels
+ *  liveboard_channel slots, each on its own cache line.  A channel's seq
+ *  is odd while it is being written and 0 until its first sample.
+ *********************************************************************************
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define LIVEBOARD_MAGIC "VMLIVE1"
+#define LIVEBOARD_VERSION 1
+#define LIVEBOARD_NAME "/vehicleMon"	// default segment, /dev/shm/vehicleMon
+
+struct liveboard_channel
+{
+	uint32_t seq;
+	uint32_t alarm;			// 1 while the channel's alarm is tripped
+	int64_t t_ns;			// CLOCK_MONOTONIC of the sample
+	int32_t code;			// sign extended adc result
+	float true_voltage;
+	double value;			// after gradient and offset
+	uint64_t samples;		// samples published on this channel
+	char pad[24];
+};
+
+struct liveboard_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t channel_size;		// sizeof(struct liveboard_channel)
+	uint32_t nchannels;
+	int32_t pid;			// the publishing process
+	int64_t offset_ns;		// wall clock minus CLOCK_MONOTONIC
+	char pad[32];
+};
+
+struct liveboard
+{
+	int fd;
+	size_t length;
+	struct liveboard_header *header;
+	struct liveboard_channel *channel;
+	int nchannels;			// mapped here, the header's may change under a reader
+	int writable;
+};
+
+int liveboard_create (struct liveboard *b, const char *name, int nchannels);
+int liveboard_attach (struct liveboard *b, const char *name);
+void liveboard_close (struct liveboard *b);
+void liveboard_publish (struct liveboard *b, int channel, int64_t t_ns, int code,
+		float true_voltage, double value, int alarm);
+int liveboard_read (const struct liveboard *b, int channel, struct liveboard_channel *out);
+
+#endif /* LIVEBOARD_H */
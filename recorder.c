@@ -0,0 +1,283 @@
+/**
+ * 	recorder.c:
+ *
+ *  Memory-mapped flight recorder, see recorder.h.  Only the read thread
+ *  calls recorder_write(); the flush thread is the only one that makes
+ *  system calls.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "recorder.h"
+#include "clockns.h"
+
+#define RECORDS_PER_PAGE (RECORDER_PAGE / sizeof(struct recorder_record))
+
+static void *recorder_loop (void *data);
+
+// a slot holds record n (0 based) if its seq is n + 1
+static int holds (struct recorder *r, uint64_t n)
+{
+	return r->ring[n % r->header->capacity].seq == n + 1;
+}
+
+/*
+ * recover:
+ *  Find the newest record.  The header's count is only as fresh as the
+ *  last flush, so carry on past it while the records follow on, and if
+ *  the record it points at never reached the disk search the whole ring.
+ *********************************************************************************
+ */
+
+static uint64_t recover (struct recorder *r)
+{
+	uint64_t i, head = r->header->head;
+
+	if (head > 0 && !holds(r, head - 1))
+	{
+		head = 0;
+		for (i = 0; i < r->header->capacity; i++)
+		{
+			if (r->ring[i].seq > head && r->ring[i].seq % r->header->capacity == (i + 1) % r->header->capacity)
+			{
+				head = r->ring[i].seq;
+			}
+		}
+	}
+
+	while (holds(r, head))
+	{
+		head++;
+	}
+	return head;
+}
+
+/*
+ * recorder_open:
+ *  Map the ring file, creating it or starting it afresh if it is not a
+ *  recorder file of this size, and start the flush thread, scheduled as
+ *  sched, see rtsched_create().
+ *
+ *  @return: 0 on success or -1 with errno set.
+ *********************************************************************************
+ */
+
+int recorder_open (struct recorder *r, const char *path, size_t bytes, const struct rtsched *sched)
+{
+	struct stat st;
+	uint64_t capacity;
+	int err;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+
+	capacity = (bytes / RECORDER_PAGE - 1) * RECORDS_PER_PAGE;
+	if (capacity == 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	r->length = RECORDER_PAGE + capacity * sizeof(struct recorder_record);
+
+	r->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (r->fd < 0 || fstat(r->fd, &st) < 0)
+	{
+		goto fail;
+	}
+
+	// reserve the blocks now, a full card must not turn into SIGBUS later
+	if ((size_t)st.st_size != r->length)
+	{
+		if (ftruncate(r->fd, 0) < 0)
+		{
+			goto fail;
+		}
+		// posix_fallocate() returns its error rather than setting errno
+		err = posix_fallocate(r->fd, 0, r->length);
+		if (err != 0)
+		{
+			errno = err;
+			goto fail;
+		}
+	}
+
+	r->map = mmap(NULL, r->length, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+	if (r->map == MAP_FAILED)
+	{
+		r->map = NULL;
+		goto fail;
+	}
+	r->header = (struct recorder_header *)r->map;
+	r->ring = (struct recorder_record *)(r->map + RECORDER_PAGE);
+
+	if (memcmp(r->header->magic, RECORDER_MAGIC, sizeof(RECORDER_MAGIC)) != 0 ||
+			r->header->version != RECORDER_VERSION ||
+			r->header->record_size != sizeof(struct recorder_record) ||
+			r->header->capacity != capacity)
+	{
+		memset(r->map, 0, r->length);
+		memcpy(r->header->magic, RECORDER_MAGIC, sizeof(RECORDER_MAGIC));
+		r->header->version = RECORDER_VERSION;
+		r->header->record_size = sizeof(struct recorder_record);
+		r->header->capacity = capacity;
+	}
+
+	r->head = r->synced = recover(r);
+	r->header->head = r->head;
+	r->offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+
+	sem_init(&r->page_done, 0, 0);
+	r->running = 1;
+	if (rtsched_create(&r->thread, "flight recorder", sched, recorder_loop, r) < 0)
+	{
+		r->running = 0;
+		sem_destroy(&r->page_done);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	err = errno;
+	if (r->map)
+	{
+		munmap(r->map, r->length);
+	}
+	if (r->fd >= 0)
+	{
+		close(r->fd);
+	}
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	errno = err;
+	return -1;
+}
+
+/*
+ * recorder_write:
+ *  Append one sample.  The seq goes in last, so a record cut short by a
+ *  power cut is never taken for a whole one.  Does nothing if the
+ *  recorder is not open.
+ *********************************************************************************
+ */
+
+void recorder_write (struct recorder *r, int channel, int bits, int gain, int code,
+		float true_voltage, float value)
+{
+	struct recorder_record *rec;
+
+	if (r->map == NULL)
+	{
+		return;
+	}
+
+	rec = &r->ring[r->head % r->header->capacity];
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	rec->t_ns = clock_ns(CLOCK_MONOTONIC) + r->offset_ns;
+	rec->code = code;
+	rec->true_voltage = true_voltage;
+	rec->value = value;
+	rec->channel = channel;
+	rec->bits = bits;
+	rec->gain = gain;
+	rec->flags = r->started ? 0 : RECORDER_START;
+	__atomic_store_n(&rec->seq, r->head + 1, __ATOMIC_RELEASE);
+
+	r->started = 1;
+	r->head++;
+	__atomic_store_n(&r->header->head, r->head, __ATOMIC_RELEASE);
+
+	if (r->head % RECORDS_PER_PAGE == 0)
+	{
+		sem_post(&r->page_done);
+	}
+}
+
+// msync the pages holding records [from, to) and then the header
+static void sync_records (struct recorder *r, uint64_t from, uint64_t to)
+{
+	uint64_t capacity = r->header->capacity;
+	uint64_t first, last;
+
+	if (to == from)
+	{
+		return;
+	}
+
+	if (to - from >= capacity)
+	{
+		first = 0;
+		last = capacity - 1;
+	}
+	else
+	{
+		first = from % capacity;
+		last = (to - 1) % capacity;
+	}
+
+	if (last < first)	// wrapped, sync the end of the ring then its start
+	{
+		msync((char *)&r->ring[first - first % RECORDS_PER_PAGE],
+				(capacity - first + first % RECORDS_PER_PAGE) * sizeof(struct recorder_record), MS_SYNC);
+		first = 0;
+	}
+
+	first -= first % RECORDS_PER_PAGE;
+	msync((char *)&r->ring[first], (last - first + 1) * sizeof(struct recorder_record), MS_SYNC);
+	msync(r->map, RECORDER_PAGE, MS_SYNC);
+}
+
+/*
+ * recorder_loop:
+ *  The flush thread, woken as each page fills or after a second.
+ *********************************************************************************
+ */
+
+static void *recorder_loop (void *data)
+{
+	struct recorder *r = data;
+	struct timespec wake;
+	uint64_t head;
+
+	while (r->running)
+	{
+		clock_gettime(CLOCK_REALTIME, &wake);
+		wake.tv_sec++;
+		sem_timedwait(&r->page_done, &wake);
+
+		head = __atomic_load_n(&r->header->head, __ATOMIC_ACQUIRE);
+		sync_records(r, r->synced, head);
+		r->synced = head;
+	}
+	return NULL;
+}
+
+void recorder_close (struct recorder *r)
+{
+	if (r->map == NULL)
+	{
+		return;
+	}
+
+	r->running = 0;
+	sem_post(&r->page_done);
+	pthread_join(r->thread, NULL);
+	sem_destroy(&r->page_done);
+
+	sync_records(r, r->synced, r->head);
+	munmap(r->map, r->length);
+	close(r->fd);
+	r->map = NULL;
+	r->fd = -1;
+}
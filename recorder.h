@@ -0,0 +1,73 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+/*
+ * recorder.h:
+ *  Flight recorder: every sample, raw code and calibrated value, appended
+ *  to a fixed-size ring in a memory-mapped file.  Writing a record is a
+ *  few stores into the mapping, no system call; a flush thread msyncs each
+ *  page as it fills, and whatever has been written once a second, so a
+ *  power cut loses at most the page being filled.
+ *
+ *  The file is a header page followed by RECORDER_RECORD sized records.
+ *  Reopening a file of the same size carries on after its newest record.
+ *********************************************************************************
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "rtsched.h"
+
+#define RECORDER_MAGIC "VMREC01"
+#define RECORDER_VERSION 1
+#define RECORDER_PAGE 4096
+#define RECORDER_DEFAULT_BYTES (16 << 20)	// about 6 minutes at 8 x 240 samples/s
+
+#define RECORDER_START 0x01		// flags: first record after the file was opened
+
+struct recorder_record
+{
+	uint64_t seq;			// 1 + records before this one, 0 for an empty slot
+	int64_t t_ns;			// wall clock, advanced by CLOCK_MONOTONIC within a run
+	int32_t code;			// sign extended adc result
+	float true_voltage;
+	float value;			// after gradient and offset
+	uint8_t channel;		// 0 based
+	uint8_t bits;
+	uint8_t gain;
+	uint8_t flags;
+};
+
+struct recorder_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t capacity;		// records in the ring
+	uint64_t head;			// records ever written, the newest is seq head
+};
+
+struct recorder
+{
+	int fd;
+	char *map;
+	size_t length;
+	struct recorder_header *header;
+	struct recorder_record *ring;
+	uint64_t head;
+	int64_t offset_ns;		// wall clock minus CLOCK_MONOTONIC at open
+	int started;
+	pthread_t thread;
+	sem_t page_done;
+	volatile int running;
+	uint64_t synced;		// records known to be on disk
+};
+
+int recorder_open (struct recorder *r, const char *path, size_t bytes, const struct rtsched *sched);
+void recorder_close (struct recorder *r);
+void recorder_write (struct recorder *r, int channel, int bits, int gain, int code,
+		float true_voltage, float value);
+
+#endif /* RECORDER_H */
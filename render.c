@@ -0,0 +1,169 @@
+/**
+ * 	render.c:
+ *
+ *  Change-only, rate limited and budgeted display updates.  The budget is a
+ *  token bucket refilled at budget bytes per second and holding at most a
+ *  quarter second's worth, so a quiet spell cannot be spent in one burst.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <geniePi.h>
+
+#include "render.h"
+
+// bytes on the wire for each command, checksum included
+#define STR_COST(len) (4 + (len))
+#define OBJ_COST 6
+
+static long elapsed_ns (const struct timespec *now, const struct timespec *then)
+{
+	return (now->tv_sec - then->tv_sec) * 1000000000L + (now->tv_nsec - then->tv_nsec);
+}
+
+void render_init (struct render *r, struct genieq *q, long budget, long interval_ns)
+{
+	memset(r, 0, sizeof(*r));
+	r->q = q;
+	r->budget = budget;
+	r->burst = budget / 4;
+	r->interval_ns = interval_ns;
+	r->tokens = r->burst;
+	clock_gettime(CLOCK_MONOTONIC, &r->refilled);
+}
+
+/*
+ * render_invalidate:
+ *  Forget what is on the screen, e.g. after a form change redraws it.
+ *********************************************************************************
+ */
+
+void render_invalidate (struct render *r)
+{
+	int i;
+
+	for (i = 0; i < RENDER_STRINGS; i++)
+	{
+		r->str[i].valid = 0;
+	}
+	for (i = 0; i < RENDER_SCOPES; i++)
+	{
+		r->scope[i].valid = 0;
+	}
+}
+
+// take cost bytes from the budget if they are there
+static int spend (struct render *r, const struct timespec *now, long cost)
+{
+	r->tokens += elapsed_ns(now, &r->refilled) * 1e-9 * r->budget;
+	if (r->tokens > r->burst)
+	{
+		r->tokens = r->burst;
+	}
+	r->refilled = *now;
+
+	if (r->tokens < cost)
+	{
+		r->stats.budget++;
+		return 0;
+	}
+	r->tokens -= cost;
+	return 1;
+}
+
+static int due (struct render *r, struct render_widget *w, const struct timespec *now)
+{
+	if (w->valid && elapsed_ns(now, &w->sent) < r->interval_ns)
+	{
+		r->stats.rate++;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * render_str:
+ *  Show text in a string widget unless it is already there.  channel and
+ *  origin_ns are passed on to the queue, see genieq_str_from().
+ *
+ *  @return: 1 if it was written or 0 if skipped.
+ *********************************************************************************
+ */
+
+int render_str (struct render *r, int index, const char *text, int channel, int64_t origin_ns)
+{
+	struct render_widget *w;
+	struct timespec now;
+	long len = strlen(text);
+
+	if (index < 0 || index >= RENDER_STRINGS)
+	{
+		return 0;
+	}
+	w = &r->str[index];
+
+	if (w->valid && strncmp(w->text, text, RENDER_TEXT - 1) == 0)
+	{
+		r->stats.same++;
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!due(r, w, &now) || !spend(r, &now, STR_COST(len)))
+	{
+		return 0;
+	}
+
+	if (genieq_str_from(r->q, GENIEQ_ROUTINE, index, text, channel, origin_ns) < 0)
+	{
+		return 0;
+	}
+	strncpy(w->text, text, RENDER_TEXT - 1);
+	w->text[RENDER_TEXT - 1] = '\0';
+	w->valid = 1;
+	w->sent = now;
+	r->stats.sent++;
+	r->stats.bytes += STR_COST(len);
+	return 1;
+}
+
+/*
+ * render_scope:
+ *  Add one point to each trace of a scope.  A scope assigns writes to its
+ *  traces in turn, so the points go out all together or not at all.  The
+ *  points are paced by the caller, see scope.h, so only the budget applies.
+ *
+ *  @return: 1 if they were written or 0 if skipped.
+ *********************************************************************************
+ */
+
+int render_scope (struct render *r, int index, const int *values, int n)
+{
+	struct render_widget *w;
+	struct timespec now;
+
+	if (index < 0 || index >= RENDER_SCOPES)
+	{
+		return 0;
+	}
+	w = &r->scope[index];
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!spend(r, &now, OBJ_COST * n))
+	{
+		return 0;
+	}
+
+	if (genieq_points(r->q, GENIEQ_ROUTINE, GENIE_OBJ_SCOPE, index, values, n) < 0)
+	{
+		return 0;
+	}
+	w->valid = 1;
+	w->sent = now;
+	r->stats.sent += n;
+	r->stats.bytes += OBJ_COST * n;
+	return 1;
+}
@@ -0,0 +1,60 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+/*
+ * render.h:
+ *  Routine display updates under a serial budget.  Remembers what each
+ *  string and scope was last sent, skips writes that would not change the
+ *  screen, limits how often each string is refreshed and keeps the total
+ *  under a bytes-per-second budget, so touch replies and alarm sounds find
+ *  the UART free.  Writes are queued at GENIEQ_ROUTINE.  Only the render
+ *  thread should call these.
+ *********************************************************************************
+ */
+
+#include <time.h>
+#include <stdint.h>
+
+#include "genieq.h"
+
+#define RENDER_STRINGS 64		// genie string indices tracked
+#define RENDER_SCOPES 4			// genie scope indices tracked
+#define RENDER_TEXT 32			// longest string remembered
+#define RENDER_BAUD_BYTES 11520		// 115200 baud, 10 bits a byte
+#define RENDER_DEFAULT_BUDGET (RENDER_BAUD_BYTES / 2)
+
+struct render_widget
+{
+	int valid;			// something has been sent since the last invalidate
+	char text[RENDER_TEXT];		// strings: what is on the screen
+	struct timespec sent;		// when it was last written
+};
+
+struct render_stats
+{
+	long sent;			// frames written
+	long bytes;			// bytes written, checksums included
+	long same;			// skipped, already on the screen
+	long rate;			// skipped, widget refreshed too recently
+	long budget;			// skipped, out of budget
+};
+
+struct render
+{
+	struct genieq *q;		// where the writes go
+	long budget;			// bytes per second for routine updates
+	long burst;			// most bytes that can go out back to back
+	long interval_ns;		// shortest time between refreshes of one widget
+	double tokens;			// bytes that may be sent now
+	struct timespec refilled;
+	struct render_widget str[RENDER_STRINGS];
+	struct render_widget scope[RENDER_SCOPES];
+	struct render_stats stats;
+};
+
+void render_init (struct render *r, struct genieq *q, long budget, long interval_ns);
+void render_invalidate (struct render *r);
+int render_str (struct render *r, int index, const char *text, int channel, int64_t origin_ns);
+int render_scope (struct render *r, int index, const int *values, int n);
+
+#endif /* RENDER_H */
@@ -0,0 +1,171 @@
+/**
+ * 	replay.c:
+ *
+ *  Replay a recorded drive through vehicleMon's calibration, alarm and
+ *  render code, to try alarm and calibration settings against real data
+ *  or time the processing on its own.  No adc is needed; the display is
+ *  the simulated one (geniesim.c).
+ *
+ *		gcc -DVEHICLEMON_NO_MAIN replay.c vehicleMon.c adcpiv3.c adcsim.c ring.c genieq.c render.c recorder.c snapshot.c samplelog.c confstore.c alarm.c sampler.c evloop.c latency.c liveboard.c scope.c rtsched.c geniesim.c \
+ *			-o replay -lgeniePi -lm -lpthread -lrt
+ *		./replay -c data.txt -x 0 samples.vsl
+ *
+ *  The settings file is loaded as vehicleMon would load it, and the log's
+ *  own calibration is only used to turn its codes back into volts.  Every
+ *  trip and clear is written to the alarm file with its logged time; the
+ *  stage latency histograms go to replay_latency.csv.  Nothing is recorded,
+ *  logged or published, and no snapshots are taken.
+ *
+ *  Options:
+ *	-c file		settings (data.txt)
+ *	-x speed	times real time, 0 for as fast as possible (0)
+ *	-a file		alarm trips and clears, CSV (replay_alarms.csv)
+ *	-m layout	adc layout the log was taken with, for its number of
+ *			channels (ADC_LAYOUT, see adc_parse_layout())
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "adcpiv3.h"
+#include "alarm.h"
+#include "samplelog.h"
+#include "geniesim.h"
+
+// from vehicleMon.c
+extern char *data_file;
+extern char *display_device;
+extern char *recorder_file;
+extern char *snapshot_index;
+extern char *log_file;
+extern char *board_name;
+extern char *latency_file;
+extern char *layout_spec;
+extern int channels;
+extern void (*on_alarm) (const struct alarm_event *ev);
+extern int64_t replay_offset_ns;
+extern int setup (void);
+extern long replay_log (const char *path, double speed);
+extern void *event_loop (void *data);
+extern void write_latency (void);
+
+static FILE *alarm_out;
+static long trips[SAMPLELOG_CHANNELS];
+static long clears[SAMPLELOG_CHANNELS];
+
+static double seconds (const struct timespec *t, const struct timespec *from)
+{
+	return (t->tv_sec - from->tv_sec) + (t->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/*
+ * log_alarm:
+ *  Count a trip or clear and write it out with its logged time.
+ *********************************************************************************
+ */
+
+static void log_alarm (const struct alarm_event *ev)
+{
+	int64_t t = ev->t_ns + replay_offset_ns;
+
+	if (ev->change == ALARM_TRIP)
+	{
+		trips[ev->channel]++;
+	}
+	else
+	{
+		clears[ev->channel]++;
+	}
+	fprintf(alarm_out, "%lld.%06lld,%d,%s,%.6f\n", (long long)(t / 1000000000LL),
+			(long long)(t % 1000000000LL / 1000), ev->channel + 1,
+			ev->change == ALARM_TRIP ? "trip" : "clear", ev->value);
+}
+
+int main (int argc, char **argv)
+{
+	int i, opt;
+	double speed = 0, elapsed;
+	char *alarm_file = "replay_alarms.csv";
+	char *path = "samples.vsl";
+	struct geniesim display;
+	struct timespec start, end;
+	pthread_t ui;
+	long n;
+
+	data_file = "data.txt";
+	while ((opt = getopt(argc, argv, "c:x:a:m:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c': data_file = optarg; break;
+		case 'x': speed = atof(optarg); break;
+		case 'a': alarm_file = optarg; break;
+		case 'm': layout_spec = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-c settings] [-x speed] [-a alarm_file] [-m adc_layout] [sample_log]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+	{
+		path = argv[optind];
+	}
+
+	alarm_out = fopen(alarm_file, "w");
+	if (alarm_out == NULL)
+	{
+		fprintf(stderr, "replay: Can't write %s: %s\n", alarm_file, strerror(errno));
+		return 1;
+	}
+	fprintf(alarm_out, "time,channel,change,value\n");
+
+	if (geniesim_open(&display, NULL) < 0)
+	{
+		fprintf(stderr, "replay: Can't create pty: %s\n", strerror(errno));
+		return 1;
+	}
+	geniesim_start(&display);
+
+	display_device = display.device;
+	recorder_file = NULL;
+	snapshot_index = NULL;
+	log_file = NULL;
+	board_name = NULL;
+	latency_file = "replay_latency.csv";
+	on_alarm = log_alarm;
+	if (setup() != 0)
+	{
+		return 1;
+	}
+	pthread_create(&ui, NULL, event_loop, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	n = replay_log(path, speed);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (n < 0)
+	{
+		return 1;
+	}
+
+	elapsed = seconds(&end, &start);
+	printf("replayed %ld samples in %.3f s, %.0f samples/s\n", n, elapsed, elapsed > 0 ? n / elapsed : 0);
+	for (i = 0; i < channels; i++)
+	{
+		if (trips[i] || clears[i])
+		{
+			printf("channel %d: %ld trips, %ld clears\n", i + 1, trips[i], clears[i]);
+		}
+	}
+	printf("alarms: written to %s\n", alarm_file);
+	write_latency();
+
+	fclose(alarm_out);
+	return 0;
+}
@@ -0,0 +1,103 @@
+/**
+ * 	ring.c:
+ *
+ *  Single-producer/single-consumer ring buffer.  head and tail only ever
+ *  increase and wrap naturally; the producer publishes an element with a
+ *  release store of head after copying it in, the consumer frees the slot
+ *  with a release store of tail after copying it out.
+ ***********************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+/*
+ * ring_init:
+ *  Allocate room for count elements, rounded up to a power of two.
+ *
+ *  @return: 0 on success or -1 if out of memory.
+ *********************************************************************************
+ */
+
+int ring_init (struct ring *r, size_t size, unsigned int count)
+{
+	unsigned int n = 1;
+
+	while (n < count)
+	{
+		n <<= 1;
+	}
+
+	r->buf = calloc(n, size);
+	if (r->buf == NULL)
+	{
+		return -1;
+	}
+	r->size = size;
+	r->mask = n - 1;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->dropped, 0);
+	return 0;
+}
+
+void ring_free (struct ring *r)
+{
+	free(r->buf);
+	r->buf = NULL;
+}
+
+/*
+ * ring_push:
+ *  Producer side.
+ *
+ *  @return: 0 if the element was queued or -1 if the ring is full.
+ *********************************************************************************
+ */
+
+int ring_push (struct ring *r, const void *elem)
+{
+	unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+	if (head - tail > r->mask)
+	{
+		atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+		return -1;
+	}
+
+	memcpy(r->buf + (head & r->mask) * r->size, elem, r->size);
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+	return 0;
+}
+
+/*
+ * ring_pop:
+ *  Consumer side.
+ *
+ *  @return: 0 if an element was copied out or -1 if the ring is empty.
+ *********************************************************************************
+ */
+
+int ring_pop (struct ring *r, void *elem)
+{
+	unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+	if (head == tail)
+	{
+		return -1;
+	}
+
+	memcpy(elem, r->buf + (tail & r->mask) * r->size, r->size);
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+	return 0;
+}
+
+unsigned int ring_used (struct ring *r)
+{
+	return atomic_load_explicit(&r->head, memory_order_acquire) -
+			atomic_load_explicit(&r->tail, memory_order_acquire);
+}
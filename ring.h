@@ -0,0 +1,35 @@
+#ifndef RING_H
+#define RING_H
+
+/*
+ * ring.h:
+ *  Lock-free single-producer/single-consumer ring of fixed size elements.
+ *  One thread may push and one other thread may pop without any locking;
+ *  neither ever blocks, a push to a full ring fails instead.
+ *********************************************************************************
+ */
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define RING_CACHE_LINE 64
+
+struct ring
+{
+	unsigned char *buf;
+	size_t size;			// bytes per element
+	unsigned int mask;		// elements - 1, a power of two
+
+	// producer and consumer positions on separate cache lines
+	_Alignas(RING_CACHE_LINE) atomic_uint head;	// next slot to push, producer only
+	_Alignas(RING_CACHE_LINE) atomic_uint tail;	// next slot to pop, consumer only
+	_Alignas(RING_CACHE_LINE) atomic_ulong dropped;	// pushes refused while full
+};
+
+int ring_init (struct ring *r, size_t size, unsigned int count);
+void ring_free (struct ring *r);
+int ring_push (struct ring *r, const void *elem);
+int ring_pop (struct ring *r, void *elem);
+unsigned int ring_used (struct ring *r);
+
+#endif /* RING_H */
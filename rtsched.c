@@ -0,0 +1,226 @@
+/**
+ * 	rtsched.c:
+ *
+ *  Thread stacks, policy, priority and CPU affinity, and memory locking, see
+ *  rtsched.h.
+ ***********************************************************************
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <pthread.h>
+
+#include "rtsched.h"
+
+static const int policy_of[] = { SCHED_OTHER, SCHED_FIFO, SCHED_RR };
+
+static const char *policy_name (int policy)
+{
+	switch (policy)
+	{
+	case SCHED_FIFO:	return "SCHED_FIFO";
+	case SCHED_RR:		return "SCHED_RR";
+	case SCHED_OTHER:	return "SCHED_OTHER";
+	default:		return "another policy";
+	}
+}
+
+// the CPUs in set as a list, "0,2,3"
+static void cpu_list (const cpu_set_t *set, char *buf, size_t size)
+{
+	int cpu;
+	size_t n = 0;
+
+	buf[0] = '\0';
+	for (cpu = 0; cpu < CPU_SETSIZE && n < size; cpu++)
+	{
+		if (CPU_ISSET(cpu, set))
+		{
+			n += snprintf(buf + n, size - n, "%s%d", n ? "," : "", cpu);
+		}
+	}
+}
+
+/*
+ * rtsched_stack:
+ *  Make bytes the stack of every thread the process starts from now on,
+ *  the library's and those started without a struct rtsched as well, so
+ *  locked memory is not mostly 8 MB stacks.  Call before any thread is
+ *  started.
+ *
+ *  @return: 0 on success or -1 with errno set.
+ *********************************************************************************
+ */
+
+int rtsched_stack (size_t bytes)
+{
+	pthread_attr_t attr;
+	int err;
+
+	pthread_attr_init(&attr);
+	err = pthread_attr_setstacksize(&attr, bytes);
+	if (err == 0)
+	{
+		err = pthread_setattr_default_np(&attr);
+	}
+	pthread_attr_destroy(&attr);
+	if (err != 0)
+	{
+		fprintf(stderr, "vehicleMon: Can't set thread stacks to %zu bytes: %s\n", bytes, strerror(err));
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+// start a thread with a RTSCHED_STACK stack and, if param is not NULL,
+// the policy and priority, and the CPUs in set if that is not NULL
+static int start_thread (pthread_t *thread, int policy, const struct sched_param *param,
+		const cpu_set_t *set, void *(*start) (void *), void *arg)
+{
+	pthread_attr_t attr;
+	int err;
+
+	pthread_attr_init(&attr);
+	err = pthread_attr_setstacksize(&attr, RTSCHED_STACK);
+	if (err == 0 && param)
+	{
+		err = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		if (err == 0)
+		{
+			err = pthread_attr_setschedpolicy(&attr, policy);
+		}
+		if (err == 0)
+		{
+			err = pthread_attr_setschedparam(&attr, param);
+		}
+	}
+	if (err == 0 && set)
+	{
+		err = pthread_attr_setaffinity_np(&attr, sizeof(*set), set);
+	}
+	if (err == 0)
+	{
+		err = pthread_create(thread, &attr, start, arg);
+	}
+	pthread_attr_destroy(&attr);
+	return err;
+}
+
+/*
+ * rtsched_create:
+ *  Start a thread already on its policy (enum rtsched_policy) and
+ *  priority, clamped to what the policy allows, and pinned to the CPUs in
+ *  the cpus mask, bit 0 for CPU 0, or free to run anywhere for
+ *  RTSCHED_ANY_CPU.  If the policy is refused the thread is started on
+ *  SCHED_OTHER, and if the CPUs are too on any CPU, with the reason
+ *  reported.  Then report what the thread got.  A NULL sched starts the
+ *  thread as any other, and reports nothing.
+ *
+ *  @return: 0 if the thread was started or -1 with errno set.
+ *********************************************************************************
+ */
+
+int rtsched_create (pthread_t *thread, const char *name, const struct rtsched *sched,
+		void *(*start) (void *), void *arg)
+{
+	struct sched_param param;
+	cpu_set_t set, *pin = NULL;
+	char granted[128];
+	int policy, priority, cpu, err;
+
+	if (sched == NULL)
+	{
+		err = start_thread(thread, SCHED_OTHER, NULL, NULL, start, arg);
+		if (err != 0)
+		{
+			errno = err;
+			return -1;
+		}
+		return 0;
+	}
+
+	policy = sched->policy;
+	if (policy < RTSCHED_OTHER || policy > RTSCHED_RR)
+	{
+		policy = RTSCHED_OTHER;
+	}
+	policy = policy_of[policy];
+
+	priority = sched->priority;
+	if (priority < sched_get_priority_min(policy))
+	{
+		priority = sched_get_priority_min(policy);
+	}
+	if (priority > sched_get_priority_max(policy))
+	{
+		priority = sched_get_priority_max(policy);
+	}
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+
+	if (sched->cpus != RTSCHED_ANY_CPU)
+	{
+		CPU_ZERO(&set);
+		for (cpu = 0; cpu < (int)(8 * sizeof(sched->cpus)); cpu++)
+		{
+			if (sched->cpus & (1UL << cpu))
+			{
+				CPU_SET(cpu, &set);
+			}
+		}
+		pin = &set;
+	}
+
+	err = start_thread(thread, policy, &param, pin, start, arg);
+	if (err != 0)
+	{
+		fprintf(stderr, "vehicleMon: Can't start %s thread on %s priority %d: %s\n",
+				name, policy_name(policy), priority, strerror(err));
+		err = start_thread(thread, SCHED_OTHER, NULL, pin, start, arg);
+	}
+	if (err != 0 && pin)
+	{
+		fprintf(stderr, "vehicleMon: Can't pin %s thread to CPUs 0x%lx: %s\n", name, sched->cpus, strerror(err));
+		err = start_thread(thread, SCHED_OTHER, NULL, NULL, start, arg);
+	}
+	if (err != 0)
+	{
+		errno = err;
+		return -1;
+	}
+
+	// what the kernel has it on
+	if (pthread_getschedparam(*thread, &policy, &param) == 0 &&
+			pthread_getaffinity_np(*thread, sizeof(set), &set) == 0)
+	{
+		cpu_list(&set, granted, sizeof(granted));
+		printf("%s thread: %s priority %d on CPUs %s\n", name, policy_name(policy), param.sched_priority, granted);
+	}
+	return 0;
+}
+
+/*
+ * rtsched_lock_memory:
+ *  Lock all the process's memory, now and as it grows, into RAM.
+ *
+ *  @return: 0 on success or -1 with errno set.
+ *********************************************************************************
+ */
+
+int rtsched_lock_memory (void)
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+	{
+		fprintf(stderr, "vehicleMon: Can't lock memory: %s\n", strerror(errno));
+		return -1;
+	}
+	printf("memory: locked\n");
+	return 0;
+}
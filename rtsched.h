@@ -0,0 +1,47 @@
+#ifndef RTSCHED_H
+#define RTSCHED_H
+
+/*
+ * rtsched.h:
+ *  Real-time scheduling for the threads that have to keep time.  Each is
+ *  created with a policy, a priority and the CPUs it may run on, so it
+ *  never runs a moment on anything else, and what the kernel actually
+ *  granted is read back and reported: without root (or CAP_SYS_NICE) a
+ *  thread is started on the normal time-sharing policy instead, and one
+ *  that can't be pinned runs on any CPU, but the thread still starts.
+ *
+ *  Every thread gets a RTSCHED_STACK stack rather than the 8 MB default,
+ *  see rtsched_stack().  Memory can then be locked with
+ *  rtsched_lock_memory() so that a thread is never held up by a page
+ *  fault; it needs root or a big enough RLIMIT_MEMLOCK.  Lock it once the
+ *  threads are running and the files mapped, so what is locked is what is
+ *  used.
+ *********************************************************************************
+ */
+
+#include <pthread.h>
+
+enum rtsched_policy
+{
+	RTSCHED_OTHER,			// SCHED_OTHER, the normal time-sharing policy
+	RTSCHED_FIFO,			// SCHED_FIFO, runs until it blocks or a higher priority is ready
+	RTSCHED_RR			// SCHED_RR, like FIFO but takes turns within a priority
+};
+
+#define RTSCHED_ANY_CPU 0		// cpus mask for no affinity
+#define RTSCHED_STACK (256 * 1024)	// stack of each thread, none needs more than a few KB
+
+// how a thread is to be scheduled
+struct rtsched
+{
+	int policy;			// enum rtsched_policy
+	int priority;			// clamped to what the policy allows
+	long cpus;			// bit 0 for CPU 0, or RTSCHED_ANY_CPU
+};
+
+int rtsched_stack (size_t bytes);
+int rtsched_create (pthread_t *thread, const char *name, const struct rtsched *sched,
+		void *(*start) (void *), void *arg);
+int rtsched_lock_memory (void);
+
+#endif /* RTSCHED_H */
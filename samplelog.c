@@ -0,0 +1,480 @@
+/**
+ * 	samplelog.c:
+ *
+ *  Delta and varint encoded sample log, see samplelog.h for the format.
+ *  samplelog_add() is for the read thread only; it queues the raw code and
+ *  returns, the encoder thread does the rest.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include <pthread.h>
+
+#include "samplelog.h"
+#include "clockns.h"
+
+#define ENCODER_IDLE_NS 20000000L	// encoder sleep when the queue is empty
+#define HEADER_FIXED offsetof(struct samplelog_block, bits)
+
+static void *samplelog_loop (void *data);
+
+static uint32_t fnv1a (const uint8_t *p, uint32_t n)
+{
+	uint32_t h = 2166136261u;
+
+	while (n--)
+	{
+		h = (h ^ *p++) * 16777619u;
+	}
+	return h;
+}
+
+static uint32_t put_varint (uint8_t *p, uint64_t v)
+{
+	uint32_t n = 0;
+
+	while (v >= 0x80)
+	{
+		p[n++] = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+// @return: bytes used, or 0 if the varint runs past end
+static uint32_t get_varint (const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	uint32_t n = 0;
+	int shift = 0;
+
+	*v = 0;
+	while (p + n < end && shift < 64)
+	{
+		*v |= (uint64_t)(p[n] & 0x7F) << shift;
+		if (!(p[n++] & 0x80))
+		{
+			return n;
+		}
+		shift += 7;
+	}
+	return 0;
+}
+
+/*
+ * samplelog_open:
+ *  Append to the log at path and start the encoder thread, scheduled as
+ *  sched, see rtsched_create().  gradient and offset are the live
+ *  calibration arrays, nchannels long; nchannels is at most
+ *  SAMPLELOG_CHANNELS.
+ *
+ *  @return: 0 on success or -1 with errno set.
+ *********************************************************************************
+ */
+
+int samplelog_open (struct samplelog *l, const char *path, int nchannels,
+		const double *gradient, const double *offset, const struct rtsched *sched)
+{
+	memset(l, 0, sizeof(*l));
+	if (nchannels < 1 || nchannels > SAMPLELOG_CHANNELS)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	l->nchannels = nchannels;
+	l->gradient = gradient;
+	l->offset = offset;
+	l->offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+
+	l->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (l->fd < 0)
+	{
+		return -1;
+	}
+
+	if (ring_init(&l->queue, sizeof(struct samplelog_entry), SAMPLELOG_QUEUE) < 0)
+	{
+		close(l->fd);
+		l->fd = -1;
+		errno = ENOMEM;
+		return -1;
+	}
+
+	l->running = 1;
+	if (rtsched_create(&l->thread, "sample log", sched, samplelog_loop, l) < 0)
+	{
+		ring_free(&l->queue);
+		close(l->fd);
+		l->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * samplelog_add:
+ *  Queue a sample for the encoder.  If the encoder has fallen behind the
+ *  sample is dropped and counted in the queue.  Does nothing if the log
+ *  is not open.
+ *********************************************************************************
+ */
+
+void samplelog_add (struct samplelog *l, const struct timespec *when, int channel,
+		int bits, int gain, int code)
+{
+	struct samplelog_entry e;
+
+	if (!l->running)
+	{
+		return;
+	}
+
+	e.t_ns = (int64_t)when->tv_sec * 1000000000LL + when->tv_nsec;
+	e.code = code;
+	e.channel = channel;
+	e.bits = bits;
+	e.gain = gain;
+	ring_push(&l->queue, &e);
+}
+
+// the per-channel parts of a block header, nchannels of each
+static int header_parts (struct samplelog_block *b, uint8_t *pad, struct iovec *iov)
+{
+	int n = b->nchannels;
+
+	iov[0].iov_base = b->bits;
+	iov[0].iov_len = n;
+	iov[1].iov_base = b->gain;
+	iov[1].iov_len = n;
+	iov[2].iov_base = pad;
+	iov[2].iov_len = (HEADER_FIXED + 2 * n) % 8 ? 8 - (HEADER_FIXED + 2 * n) % 8 : 0;
+	iov[3].iov_base = b->gradient;
+	iov[3].iov_len = n * sizeof(double);
+	iov[4].iov_base = b->offset;
+	iov[4].iov_len = n * sizeof(double);
+	return 5;
+}
+
+// write the block being encoded, one write() for header and payload
+static void flush_block (struct samplelog *l)
+{
+	static uint8_t zeros[8];
+	struct iovec iov[7];
+	ssize_t n;
+	int parts;
+
+	if (l->block.samples == 0)
+	{
+		return;
+	}
+
+	l->block.check = fnv1a(l->payload, l->block.bytes);
+	iov[0].iov_base = &l->block;
+	iov[0].iov_len = HEADER_FIXED;
+	parts = header_parts(&l->block, zeros, iov + 1);
+	iov[parts + 1].iov_base = l->payload;
+	iov[parts + 1].iov_len = l->block.bytes;
+
+	n = writev(l->fd, iov, parts + 2);
+	if (n < 0)
+	{
+		fprintf(stderr, "vehicleMon: Can't write sample log: %s\n", strerror(errno));
+	}
+	else
+	{
+		l->blocks++;
+		l->bytes += n;
+	}
+
+	l->block.samples = 0;
+	l->block.bytes = 0;
+}
+
+static void start_block (struct samplelog *l, const struct samplelog_entry *e)
+{
+	int i;
+
+	memcpy(l->block.magic, SAMPLELOG_MAGIC, sizeof(l->block.magic));
+	l->block.version = SAMPLELOG_VERSION;
+	l->block.nchannels = l->nchannels;
+	l->block.t_ns = e->t_ns + l->offset_ns;
+	for (i = 0; i < l->nchannels; i++)
+	{
+		l->block.bits[i] = 0;		// filled in as each channel turns up
+		l->block.gain[i] = 0;
+		l->block.gradient[i] = l->gradient[i];
+		l->block.offset[i] = l->offset[i];
+		l->last_code[i] = 0;
+	}
+	l->first_ns = l->last_ns = e->t_ns;
+}
+
+static void encode (struct samplelog *l, const struct samplelog_entry *e)
+{
+	struct samplelog_block *b = &l->block;
+	int ch = e->channel;
+	int64_t dt_us, code;
+
+	if (ch >= l->nchannels)
+	{
+		return;
+	}
+
+	// a block has one calibration and mode per channel, a change starts a new one
+	if (b->samples > 0 && ((b->bits[ch] && (b->bits[ch] != e->bits || b->gain[ch] != e->gain)) ||
+			b->gradient[ch] != l->gradient[ch] || b->offset[ch] != l->offset[ch]))
+	{
+		flush_block(l);
+	}
+
+	if (b->samples == 0)
+	{
+		start_block(l, e);
+	}
+	b->bits[ch] = e->bits;
+	b->gain[ch] = e->gain;
+
+	// whole microseconds, carried so rounding never adds up
+	dt_us = (e->t_ns - l->last_ns) / 1000;
+	if (dt_us < 0)
+	{
+		dt_us = 0;
+	}
+	l->last_ns += dt_us * 1000;
+
+	code = (int64_t)e->code - l->last_code[ch];
+	l->last_code[ch] = e->code;
+
+	b->bytes += put_varint(l->payload + b->bytes, ((uint64_t)dt_us << 5) | ch);
+	b->bytes += put_varint(l->payload + b->bytes, (uint64_t)((code << 1) ^ (code >> 63)));
+	b->samples++;
+	l->samples++;
+
+	if (b->bytes >= SAMPLELOG_BLOCK)
+	{
+		flush_block(l);
+	}
+}
+
+/*
+ * samplelog_loop:
+ *  The encoder thread.  Empties the queue, writes a block once it is full
+ *  or its first sample is SAMPLELOG_FLUSH_NS old, then sleeps a little.
+ *********************************************************************************
+ */
+
+static void *samplelog_loop (void *data)
+{
+	struct samplelog *l = data;
+	struct samplelog_entry e;
+	struct timespec idle = { 0, ENCODER_IDLE_NS };
+	int running;
+
+	do
+	{
+		running = l->running;
+		while (ring_pop(&l->queue, &e) == 0)
+		{
+			encode(l, &e);
+		}
+
+		if (l->block.samples > 0 && (!running || clock_ns(CLOCK_MONOTONIC) - l->first_ns >= SAMPLELOG_FLUSH_NS))
+		{
+			flush_block(l);
+		}
+		if (running)
+		{
+			nanosleep(&idle, NULL);
+		}
+	} while (running);
+	return NULL;
+}
+
+void samplelog_close (struct samplelog *l)
+{
+	if (!l->running)
+	{
+		return;
+	}
+
+	l->running = 0;
+	pthread_join(l->thread, NULL);
+	ring_free(&l->queue);
+	close(l->fd);
+	l->fd = -1;
+}
+
+/*
+ * samplelog_reader_open:
+ *  Open a log for samplelog_next().
+ *
+ *  @return: 0 on success or -1 with errno set.
+ *********************************************************************************
+ */
+
+int samplelog_reader_open (struct samplelog_reader *r, const char *path)
+{
+	memset(r, 0, sizeof(*r));
+	r->fp = fopen(path, "rb");
+	return r->fp ? 0 : -1;
+}
+
+void samplelog_reader_close (struct samplelog_reader *r)
+{
+	if (r->fp)
+	{
+		fclose(r->fp);
+		r->fp = NULL;
+	}
+}
+
+// move on to the next block magic after a damaged block that started at from
+static void resync (struct samplelog_reader *r, long from)
+{
+	char window[4] = { 0 };
+	int c;
+
+	r->skipped++;
+	fseek(r->fp, from + 1, SEEK_SET);
+	while ((c = getc(r->fp)) != EOF)
+	{
+		memmove(window, window + 1, 3);
+		window[3] = c;
+		if (memcmp(window, SAMPLELOG_MAGIC, 4) == 0)
+		{
+			fseek(r->fp, -4, SEEK_CUR);
+			return;
+		}
+	}
+}
+
+// version 1 blocks are always 8 channels, later ones up to SAMPLELOG_CHANNELS
+static int header_ok (const struct samplelog_block *b, size_t payload)
+{
+	if (memcmp(b->magic, SAMPLELOG_MAGIC, 4) != 0 || b->bytes > payload)
+	{
+		return 0;
+	}
+	if (b->version == 1)
+	{
+		return b->nchannels == 8;
+	}
+	return b->version == SAMPLELOG_VERSION && b->nchannels >= 1 && b->nchannels <= SAMPLELOG_CHANNELS;
+}
+
+// read blocks until one checks out, @return: 0 at the end of the log
+static int next_block (struct samplelog_reader *r)
+{
+	struct samplelog_block *b = &r->block;
+	struct iovec iov[5];
+	uint8_t pad[8];
+	long from;
+	int i, parts, whole;
+
+	for (;;)
+	{
+		from = ftell(r->fp);
+		if (fread(b, HEADER_FIXED, 1, r->fp) != 1)
+		{
+			return 0;
+		}
+
+		if (!header_ok(b, sizeof(r->payload)))
+		{
+			resync(r, from);
+			continue;
+		}
+
+		parts = header_parts(b, pad, iov);
+		for (i = 0, whole = 1; i < parts && whole; i++)
+		{
+			whole = fread(iov[i].iov_base, 1, iov[i].iov_len, r->fp) == iov[i].iov_len;
+		}
+		if (!whole)
+		{
+			return 0;
+		}
+
+		if (fread(r->payload, 1, b->bytes, r->fp) != b->bytes)
+		{
+			return 0;	// cut short, the log was still being written
+		}
+		if (fnv1a(r->payload, b->bytes) != b->check)
+		{
+			resync(r, from);
+			continue;
+		}
+
+		r->pos = 0;
+		r->left = b->samples;
+		r->t_ns = b->t_ns;
+		memset(r->last_code, 0, sizeof(r->last_code));
+		return 1;
+	}
+}
+
+/*
+ * samplelog_next:
+ *  Decode the next sample in the log.
+ *
+ *  @return: 1 with the sample in s, or 0 at the end of the log.
+ *********************************************************************************
+ */
+
+int samplelog_next (struct samplelog_reader *r, struct samplelog_sample *s)
+{
+	struct samplelog_block *b = &r->block;
+	const uint8_t *end;
+	uint64_t head, delta;
+	uint32_t n, m;
+	int ch, shift;
+
+	for (;;)
+	{
+		if (r->left == 0 && !next_block(r))
+		{
+			return 0;
+		}
+
+		end = r->payload + b->bytes;
+		n = get_varint(r->payload + r->pos, end, &head);
+		m = n ? get_varint(r->payload + r->pos + n, end, &delta) : 0;
+		if (m == 0)
+		{
+			r->skipped++;	// the count and the payload disagree
+			r->left = 0;
+			continue;
+		}
+		r->pos += n + m;
+		r->left--;
+
+		shift = b->version == 1 ? 3 : 5;
+		ch = head & ((1 << shift) - 1);
+		if (ch >= b->nchannels)
+		{
+			r->skipped++;
+			r->left = 0;
+			continue;
+		}
+		r->t_ns += (int64_t)(head >> shift) * 1000;
+		r->last_code[ch] += (int32_t)((delta >> 1) ^ -(int64_t)(delta & 1));
+
+		s->t_ns = r->t_ns;
+		s->channel = ch;
+		s->code = r->last_code[ch];
+		s->bits = b->bits[ch];
+		s->gain = b->gain[ch];
+		s->true_voltage = s->bits && s->gain ? s->code * (float)(4.096 / (1 << s->bits) / s->gain) : 0;
+		s->value = b->gradient[ch] * s->true_voltage + b->offset[ch];
+		return 1;
+	}
+}
@@ -0,0 +1,122 @@
+#ifndef SAMPLELOG_H
+#define SAMPLELOG_H
+
+/*
+ * samplelog.h:
+ *  Compact long-term log of adc samples.  The read thread hands raw codes
+ *  to a bounded ring; an encoder thread packs them into blocks and appends
+ *  each block to the log with a single write.
+ *
+ *  A block is a header followed by its payload.  The header is the fields
+ *  of struct samplelog_block up to bits, then the resolution and gain of
+ *  each of its nchannels channels as bytes, zeros up to a multiple of 8
+ *  bytes, and the gradient and offset of each channel as doubles.  In the
+ *  payload each sample is two LEB128 varints:
+ *
+ *	(microseconds since the previous sample << 5) | channel
+ *	zigzag(code - previous code of the same channel)
+ *
+ *  so a slowly moving channel costs 3 to 4 bytes a sample.  Version 1 logs,
+ *  always 8 channels with the channel in 3 bits, are still read.  Times and codes
+ *  start from 0 in every block, so a block decodes on its own; a damaged
+ *  one is skipped by searching for the next block magic.
+ *********************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "ring.h"
+#include "rtsched.h"
+
+#define SAMPLELOG_MAGIC "VSL1"
+#define SAMPLELOG_VERSION 2
+#define SAMPLELOG_CHANNELS 32		// channel numbers fit in 5 bits
+#define SAMPLELOG_BLOCK 8192		// payload bytes before a block is written
+#define SAMPLELOG_FLUSH_NS 1000000000L	// longest a sample waits to be written
+#define SAMPLELOG_QUEUE 4096		// samples waiting for the encoder
+
+struct samplelog_block
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t nchannels;
+	uint32_t samples;
+	uint32_t bytes;			// of payload
+	uint32_t check;			// FNV-1a of the payload
+	int64_t t_ns;			// wall clock of the first sample
+	// nchannels of each on disk, see above
+	uint8_t bits[SAMPLELOG_CHANNELS];
+	uint8_t gain[SAMPLELOG_CHANNELS];
+	double gradient[SAMPLELOG_CHANNELS];
+	double offset[SAMPLELOG_CHANNELS];
+};
+
+// one sample on its way to the encoder
+struct samplelog_entry
+{
+	int64_t t_ns;			// CLOCK_MONOTONIC
+	int32_t code;
+	uint8_t channel;
+	uint8_t bits;
+	uint8_t gain;
+};
+
+struct samplelog
+{
+	int fd;
+	int nchannels;
+	struct ring queue;
+	const double *gradient;		// calibration of each channel, read by the encoder
+	const double *offset;
+	int64_t offset_ns;		// wall clock minus CLOCK_MONOTONIC
+	pthread_t thread;
+	volatile int running;
+
+	// the block being encoded, encoder thread only
+	struct samplelog_block block;
+	uint8_t payload[SAMPLELOG_BLOCK + 32];
+	int64_t first_ns, last_ns;
+	int32_t last_code[SAMPLELOG_CHANNELS];
+
+	long blocks;
+	long bytes;			// written to the log
+	long samples;
+};
+
+// a decoded sample
+struct samplelog_sample
+{
+	int64_t t_ns;			// wall clock
+	int channel;
+	int code;
+	int bits;
+	int gain;
+	double true_voltage;
+	double value;			// after gradient and offset
+};
+
+struct samplelog_reader
+{
+	FILE *fp;
+	struct samplelog_block block;
+	uint8_t payload[SAMPLELOG_BLOCK + 32];
+	uint32_t pos;
+	uint32_t left;			// samples still to come from this block
+	int64_t t_ns;
+	int32_t last_code[SAMPLELOG_CHANNELS];
+	long skipped;			// damaged blocks passed over
+};
+
+int samplelog_open (struct samplelog *l, const char *path, int nchannels,
+		const double *gradient, const double *offset, const struct rtsched *sched);
+void samplelog_close (struct samplelog *l);
+void samplelog_add (struct samplelog *l, const struct timespec *when, int channel,
+		int bits, int gain, int code);
+
+int samplelog_reader_open (struct samplelog_reader *r, const char *path);
+int samplelog_next (struct samplelog_reader *r, struct samplelog_sample *s);
+void samplelog_reader_close (struct samplelog_reader *r);
+
+#endif /* SAMPLELOG_H */
@@ -0,0 +1,179 @@
+/**
+ * 	sampler.c:
+ *
+ *  Priority and rate driven choice of the next channel to convert, see
+ *  sampler.h.
+ ***********************************************************************
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sampler.h"
+
+int sampler_init (struct sampler *s, int nchannels, const double *rate, const int *priority,
+		const struct alarm_rules *rules, const double *values)
+{
+	memset(s, 0, sizeof(*s));
+	s->nchannels = nchannels;
+	s->rate = rate;
+	s->priority = priority;
+	s->rules = rules;
+	s->values = values;
+
+	s->due = calloc(nchannels, sizeof(int64_t));
+	s->count = calloc(nchannels, sizeof(long));
+	s->achieved = calloc(nchannels, sizeof(double));
+	if (s->due == NULL || s->count == NULL || s->achieved == NULL)
+	{
+		free(s->due);
+		free(s->count);
+		free(s->achieved);
+		return -1;
+	}
+	return 0;
+}
+
+// whether due channel j should go before best: higher priority first, then
+// a channel with a rate before one taking spare time, then the longest overdue
+static int before (const struct sampler *s, int j, int best)
+{
+	int rated = s->rate[j] > 0, best_rated = s->rate[best] > 0;
+
+	if (s->priority[j] != s->priority[best])
+	{
+		return s->priority[j] > s->priority[best];
+	}
+	if (rated != best_rated)
+	{
+		return rated;
+	}
+	return s->due[j] < s->due[best];
+}
+
+/*
+ * sampler_next:
+ *  Pick the channel to convert next out of first to first + n - 1.
+ *
+ *  @return: the channel, or -1 if none is due yet, in which case wake_ns is
+ *  brought forward to when the first one will be.
+ *********************************************************************************
+ */
+
+int sampler_next (struct sampler *s, int first, int n, int64_t now_ns, int64_t *wake_ns)
+{
+	int j, best = -1;
+
+	for (j = first; j < first + n; j++)
+	{
+		if (s->priority[j] <= 0)
+		{
+			continue;
+		}
+		if (s->due[j] > now_ns)
+		{
+			if (s->due[j] < *wake_ns)
+			{
+				*wake_ns = s->due[j];
+			}
+			continue;
+		}
+		if (best < 0 || before(s, j, best))
+		{
+			best = j;
+		}
+	}
+	return best;
+}
+
+// an armed channel close to or past one of its alarm limits
+static int near_limit (const struct sampler *s, int j)
+{
+	const struct alarm_rules *r = s->rules;
+	double v, lo, hi;
+	int outside;
+
+	if (!r->armed[j])
+	{
+		return 0;
+	}
+
+	v = s->values[j];
+	lo = fmin(r->min[j], r->max[j]);
+	hi = fmax(r->min[j], r->max[j]);
+	outside = (v < lo) | (v > hi);
+	return (outside ^ (r->mode[j] == ALARM_INVERTED)) ||
+			fmin(fabs(v - lo), fabs(v - hi)) <= SAMPLER_NEAR * (hi - lo);
+}
+
+/*
+ * sampler_done:
+ *  Note a conversion of channel, after its value has been stored, and work
+ *  out when it is next due.
+ *********************************************************************************
+ */
+
+void sampler_done (struct sampler *s, int channel, int64_t now_ns)
+{
+	double rate = s->rate[channel];
+	int64_t period;
+
+	s->count[channel]++;
+	if (rate <= 0)
+	{
+		s->due[channel] = now_ns;	// due again straight away, behind any rated channel
+		return;
+	}
+
+	if (near_limit(s, channel))
+	{
+		rate *= SAMPLER_BOOST;
+	}
+	period = (int64_t)(1e9 / rate);
+
+	// keep to the schedule, but never carry more than a period of backlog
+	s->due[channel] += period;
+	if (s->due[channel] < now_ns - period)
+	{
+		s->due[channel] = now_ns - period;
+	}
+}
+
+/*
+ * sampler_report:
+ *  At the end of each report period, fill in achieved and missing.
+ *
+ *  @return: 1 if a period has just ended, otherwise 0.
+ *********************************************************************************
+ */
+
+int sampler_report (struct sampler *s, int64_t now_ns)
+{
+	double seconds;
+	int j;
+
+	if (s->period_start == 0)
+	{
+		s->period_start = now_ns;
+		return 0;
+	}
+	if (now_ns - s->period_start < SAMPLER_REPORT_NS)
+	{
+		return 0;
+	}
+
+	seconds = (now_ns - s->period_start) / 1e9;
+	s->missing = 0;
+	for (j = 0; j < s->nchannels; j++)
+	{
+		s->achieved[j] = s->count[j] / seconds;
+		s->count[j] = 0;
+		if (s->priority[j] > 0 && s->rate[j] > 0 && s->achieved[j] < SAMPLER_MISS * s->rate[j])
+		{
+			s->missing |= 1UL << j;
+		}
+	}
+	s->period_start = now_ns;
+	return 1;
+}
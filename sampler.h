@@ -0,0 +1,52 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+/*
+ * sampler.h:
+ *  Chooses which channel each chip converts next.  Every channel has a
+ *  target rate and a priority from the settings arrays:
+ *
+ *	rate		samples per second, 0 to take whatever time is spare
+ *	priority	0 switches the channel off, otherwise higher goes first
+ *
+ *  Of the channels that are due, the highest priority is converted first;
+ *  at equal priority a channel with a rate goes before any taking spare
+ *  time, and the longest overdue breaks a tie, so with equal priorities
+ *  and no rates the channels simply take turns.  An armed channel within
+ *  SAMPLER_NEAR of the width of its alarm band from a limit, or past one,
+ *  is sampled SAMPLER_BOOST times as often.  Every SAMPLER_REPORT_NS the
+ *  rates achieved are compared with the targets.
+ *********************************************************************************
+ */
+
+#include <stdint.h>
+
+#include "alarm.h"
+
+#define SAMPLER_BOOST 4			// rate multiplier near an alarm limit
+#define SAMPLER_NEAR 0.1		// of the band width
+#define SAMPLER_REPORT_NS 10000000000LL	// rate check period
+#define SAMPLER_MISS 0.9		// below this fraction of its target a channel is missing it
+
+struct sampler
+{
+	int nchannels;
+	const double *rate;
+	const int *priority;
+	const struct alarm_rules *rules;
+	const double *values;		// latest value of each channel
+
+	int64_t *due;			// when each channel should next be converted
+	long *count;			// conversions in this report period
+	double *achieved;		// rate over the last report period
+	unsigned long missing;		// channels below their target last period
+	int64_t period_start;
+};
+
+int sampler_init (struct sampler *s, int nchannels, const double *rate, const int *priority,
+		const struct alarm_rules *rules, const double *values);
+int sampler_next (struct sampler *s, int first, int n, int64_t now_ns, int64_t *wake_ns);
+void sampler_done (struct sampler *s, int channel, int64_t now_ns);
+int sampler_report (struct sampler *s, int64_t now_ns);
+
+#endif /* SAMPLER_H */
@@ -0,0 +1,150 @@
+/**
+ * 	scope.c:
+ *
+ *  Min/max decimating scope traces, see scope.h.  Only the render thread
+ *  uses them.
+ ***********************************************************************
+ */
+
+#include <string.h>
+
+#include "scope.h"
+
+/*
+ * scope_init:
+ *  Start a scope of traces showing window_ns across columns columns, or
+ *  start it again empty with a new window.
+ *********************************************************************************
+ */
+
+void scope_init (struct scope *s, int traces, int columns, int64_t window_ns)
+{
+	memset(s, 0, sizeof(*s));
+	s->traces = traces < SCOPE_TRACES ? traces : SCOPE_TRACES;
+	s->columns = columns;
+	s->column_ns = window_ns / columns;
+}
+
+static void push (struct scope *s, const int *values)
+{
+	if (s->head - s->tail == SCOPE_BACKLOG)
+	{
+		s->tail++;
+		s->dropped++;
+	}
+	memcpy(s->point[s->head % SCOPE_BACKLOG], values, sizeof(s->point[0]));
+	s->head++;
+}
+
+/*
+ * finish:
+ *  Turn the column into its two points.  Each trace goes to whichever of
+ *  its minimum and maximum is nearer its last point first, so that an
+ *  envelope reads as a band rather than a saw.
+ *********************************************************************************
+ */
+
+static void finish (struct scope *s)
+{
+	int first[SCOPE_TRACES], second[SCOPE_TRACES];
+	int i, lo, hi;
+
+	for (i = 0; i < s->traces; i++)
+	{
+		if (s->seen[i] == 0)
+		{
+			s->min[i] = s->max[i] = s->last[i];
+		}
+		lo = s->min[i];
+		hi = s->max[i];
+		if (s->last[i] - lo <= hi - s->last[i])
+		{
+			first[i] = lo;
+			second[i] = hi;
+		}
+		else
+		{
+			first[i] = hi;
+			second[i] = lo;
+		}
+		s->last[i] = second[i];
+		s->seen[i] = 0;
+	}
+	push(s, first);
+	push(s, second);
+}
+
+/*
+ * scope_add:
+ *  Take a sample of trace at t_ns, CLOCK_MONOTONIC, already scaled to the
+ *  scope.  Samples should come in time order; one from before the column
+ *  being filled joins it.
+ *********************************************************************************
+ */
+
+void scope_add (struct scope *s, int trace, int64_t t_ns, int value)
+{
+	int n = 0;
+
+	if (trace < 0 || trace >= s->traces)
+	{
+		return;
+	}
+
+	if (s->column_end == 0)
+	{
+		s->column_end = t_ns + s->column_ns;
+	}
+
+	// finish every column up to this sample's, but after a gap of a whole
+	// window only the last one is worth drawing
+	while (t_ns >= s->column_end)
+	{
+		if (n++ < s->columns)
+		{
+			finish(s);
+		}
+		else
+		{
+			s->column_end += (t_ns - s->column_end) / s->column_ns * s->column_ns;
+		}
+		s->column_end += s->column_ns;
+	}
+
+	if (s->seen[trace] == 0 || value < s->min[trace])
+	{
+		s->min[trace] = value;
+	}
+	if (s->seen[trace] == 0 || value > s->max[trace])
+	{
+		s->max[trace] = value;
+	}
+	s->seen[trace]++;
+}
+
+/*
+ * scope_peek, scope_pop:
+ *  The oldest point waiting for the display, one value per trace, and
+ *  taking it off once it has been sent.
+ *
+ *  @return: 1 if there is one, otherwise 0.
+ *********************************************************************************
+ */
+
+int scope_peek (const struct scope *s, const int **values)
+{
+	if (s->head == s->tail)
+	{
+		return 0;
+	}
+	*values = s->point[s->tail % SCOPE_BACKLOG];
+	return 1;
+}
+
+void scope_pop (struct scope *s)
+{
+	if (s->head != s->tail)
+	{
+		s->tail++;
+	}
+}
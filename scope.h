@@ -0,0 +1,47 @@
+#ifndef SCOPE_H
+#define SCOPE_H
+
+/*
+ * scope.h:
+ *  Min/max decimation for a GENIE_OBJ_SCOPE.  The window shown is split
+ *  into columns of equal time; every sample of each trace goes into the
+ *  minimum and maximum of its column, and each finished column becomes two
+ *  points, its minimum and maximum, so a spike between two points is still
+ *  drawn and the trace moves at the same speed whatever the sample rate.
+ *  A trace with no sample in a column holds its last value.
+ *
+ *  Columns are timed by the samples, not the clock, so a scope only moves
+ *  while its channels are sampled.  Finished points wait in a short queue
+ *  for the display; if it falls too far behind the oldest are dropped.
+ *********************************************************************************
+ */
+
+#include <stdint.h>
+
+#define SCOPE_TRACES 4			// traces on one scope widget
+#define SCOPE_BACKLOG 32		// points waiting for the display, a power of 2
+
+struct scope
+{
+	int traces;
+	int columns;			// columns across the window
+	int64_t column_ns;
+	int64_t column_end;		// when the column being filled ends, 0 before the first sample
+
+	// the column being filled
+	int min[SCOPE_TRACES];
+	int max[SCOPE_TRACES];
+	int seen[SCOPE_TRACES];		// samples in it
+	int last[SCOPE_TRACES];		// last point sent, held through empty columns
+
+	int point[SCOPE_BACKLOG][SCOPE_TRACES];
+	unsigned int head, tail;
+	long dropped;			// points the display had no room for
+};
+
+void scope_init (struct scope *s, int traces, int columns, int64_t window_ns);
+void scope_add (struct scope *s, int trace, int64_t t_ns, int value);
+int scope_peek (const struct scope *s, const int **values);
+void scope_pop (struct scope *s);
+
+#endif /* SCOPE_H */
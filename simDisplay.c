@@ -0,0 +1,180 @@
+/**
+ * 	simDisplay.c:
+ *
+ *  Run a simulated Genie display on a pseudo-terminal and log everything
+ *  vehicleMon sends to it.
+ *
+ *		./simDisplay -l /tmp/genie -s touches.txt
+ *		./vehicleMon -d /tmp/genie -s "1=sine:0.5:2"
+ *
+ *  Each line of the log is one frame: seconds since start, command, object,
+ *  index and value or string, and its size in bytes.  The touch script has
+ *  one event per line, "<ms after start> <object> <index> <value>", and
+ *  the time to the first frame after each event is logged as the UI latency.
+ *  A summary of frames and serial bytes per second is printed on exit.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include <geniePi.h>
+
+#include "geniesim.h"
+
+static struct geniesim sim;
+static volatile int running = 1;
+static volatile int quiet = 0;
+
+// set when an event is injected, cleared by the first frame after it
+static struct timespec event_time;
+static volatile int event_pending = 0;
+
+static double seconds (const struct timespec *t, const struct timespec *from)
+{
+	return (t->tv_sec - from->tv_sec) + (t->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static void log_frame (struct geniesim *g, const struct geniesim_frame *f, void *arg)
+{
+	if (event_pending)
+	{
+		event_pending = 0;
+		printf("%10.6f latency %.3f ms\n", seconds(&f->when, &g->started),
+				seconds(&f->when, &event_time) * 1000);
+	}
+
+	if (quiet)
+	{
+		return;
+	}
+
+	if (f->cmd == GENIE_WRITE_STR || f->cmd == GENIE_WRITE_STRU)
+	{
+		printf("%10.6f %-14s       %3d \"%s\" (%d bytes)\n", seconds(&f->when, &g->started),
+				geniesim_cmd_name(f->cmd), f->index, f->str, f->length);
+	}
+	else
+	{
+		printf("%10.6f %-14s %3d %3d %5u (%d bytes)\n", seconds(&f->when, &g->started),
+				geniesim_cmd_name(f->cmd), f->object, f->index, f->data, f->length);
+	}
+}
+
+static void stop (int sig)
+{
+	running = 0;
+}
+
+static void run_script (const char *path)
+{
+	FILE *fp;
+	char line[128];
+	long at;
+	int object, index;
+	unsigned int value;
+	struct timespec t;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "simDisplay: Can't open %s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	while (running && fgets(line, sizeof(line), fp))
+	{
+		if (line[0] == '#' || sscanf(line, "%ld %d %d %u", &at, &object, &index, &value) != 4)
+		{
+			continue;
+		}
+
+		t = sim.started;
+		t.tv_sec += at / 1000;
+		t.tv_nsec += (at % 1000) * 1000000L;
+		if (t.tv_nsec >= 1000000000L)
+		{
+			t.tv_nsec -= 1000000000L;
+			t.tv_sec++;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR && running)
+			;
+
+		clock_gettime(CLOCK_MONOTONIC, &event_time);
+		event_pending = 1;
+		geniesim_inject(&sim, object, index, value);
+		printf("%10.6f EVENT          %3d %3d %5u\n", seconds(&event_time, &sim.started),
+				object, index, value);
+	}
+	fclose(fp);
+}
+
+int main (int argc, char **argv)
+{
+	int opt;
+	char *link = NULL;
+	char *script = NULL;
+	struct timespec now;
+	double elapsed;
+
+	while ((opt = getopt(argc, argv, "l:s:q")) != -1)
+	{
+		switch (opt)
+		{
+		case 'l':
+			link = optarg;
+			break;
+		case 's':
+			script = optarg;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-l link] [-s touch_script] [-q]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (geniesim_open(&sim, link) < 0)
+	{
+		fprintf(stderr, "simDisplay: Can't create pty: %s\n", strerror(errno));
+		return 1;
+	}
+
+	sim.on_frame = log_frame;
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	printf("display on %s\n", sim.device);
+	geniesim_start(&sim);
+
+	if (script)
+	{
+		run_script(script);
+	}
+
+	while (running)
+	{
+		pause();
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = seconds(&now, &sim.started);
+	printf("%ld frames, %ld bytes, %ld errors, %ld events in %.1f s: %.1f bytes/s (%.1f%% of 115200 baud)\n",
+			sim.frames, sim.bytes, sim.errors, sim.events, elapsed,
+			sim.bytes / elapsed, sim.bytes * 10 / elapsed / 115200 * 100);
+
+	geniesim_close(&sim);
+	if (link)
+	{
+		unlink(link);
+	}
+	return 0;
+}
@@ -0,0 +1,262 @@
+/**
+ * 	snapshot.c:
+ *
+ *  Pre- and post-trigger alarm snapshots, see snapshot.h.  The history is
+ *  a plain array the read thread overwrites in turn; the writer copies a
+ *  window out of it and then checks how much of the copy was overwritten
+ *  while it worked, rather than ever making the read thread wait.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "snapshot.h"
+#include "clockns.h"
+
+#define SNAPSHOT_JOBS 8			// closed windows waiting for the writer
+#define SNAPSHOT_SLACK 1024		// samples the read thread may add while a copy is made
+
+static void *snapshot_loop (void *data);
+
+/*
+ * snapshot_init:
+ *  Allocate a history big enough for pre_s + post_s seconds at rate
+ *  samples per second, all channels together, and start the writer thread,
+ *  scheduled as sched, see rtsched_create().
+ *
+ *  @return: 0 on success or -1.
+ *********************************************************************************
+ */
+
+int snapshot_init (struct snapshot *s, int pre_s, int post_s, double rate, const char *index,
+		const struct rtsched *sched)
+{
+	double needed = (pre_s + post_s) * rate + SNAPSHOT_SLACK;
+
+	memset(s, 0, sizeof(*s));
+	s->pre_ns = pre_s * 1000000000LL;
+	s->post_ns = post_s * 1000000000LL;
+	s->index = index;
+	s->offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+
+	for (s->size = 2 * SNAPSHOT_SLACK; s->size < needed; s->size *= 2)
+		;
+	s->history = calloc(s->size, sizeof(struct snapshot_sample));
+	if (s->history == NULL)
+	{
+		return -1;
+	}
+
+	if (ring_init(&s->jobs, sizeof(struct snapshot_job), SNAPSHOT_JOBS) < 0)
+	{
+		free(s->history);
+		s->history = NULL;
+		return -1;
+	}
+
+	sem_init(&s->ready, 0, 0);
+	if (rtsched_create(&s->thread, "snapshot", sched, snapshot_loop, s) < 0)
+	{
+		ring_free(&s->jobs);
+		free(s->history);
+		s->history = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * snapshot_add:
+ *  Keep a sample, and close the open window once it is post seconds old.
+ *  Does nothing if snapshot_init() failed.
+ *********************************************************************************
+ */
+
+void snapshot_add (struct snapshot *s, const struct timespec *when, int channel,
+		float true_voltage, float value)
+{
+	struct snapshot_sample *p;
+
+	if (s->history == NULL)
+	{
+		return;
+	}
+
+	p = &s->history[s->head & (s->size - 1)];
+	p->t_ns = (int64_t)when->tv_sec * 1000000000LL + when->tv_nsec;
+	p->channel = channel;
+	p->true_voltage = true_voltage;
+	p->value = value;
+	__atomic_store_n(&s->head, s->head + 1, __ATOMIC_RELEASE);
+
+	if (s->open && p->t_ns >= s->end_ns)
+	{
+		s->open = 0;
+		s->job.end = s->head;
+		if (ring_push(&s->jobs, &s->job) < 0)
+		{
+			s->dropped++;
+			return;
+		}
+		sem_post(&s->ready);
+	}
+}
+
+/*
+ * snapshot_trigger:
+ *  An alarm has just fired on channel, call after adding the sample that
+ *  set it off.
+ *********************************************************************************
+ */
+
+void snapshot_trigger (struct snapshot *s, int channel)
+{
+	if (s->history == NULL || s->head == 0)
+	{
+		return;
+	}
+
+	if (!s->open)
+	{
+		s->open = 1;
+		s->job.trigger = s->head - 1;
+		s->job.trigger_ns = s->history[s->job.trigger & (s->size - 1)].t_ns;
+		s->job.alarmed = 0;
+		s->end_ns = s->job.trigger_ns + s->post_ns;
+	}
+	s->job.alarmed |= 1u << channel;
+}
+
+// the oldest sample the writer can still rely on
+static unsigned long oldest (struct snapshot *s)
+{
+	unsigned long head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+
+	return head > s->size - SNAPSHOT_SLACK ? head - (s->size - SNAPSHOT_SLACK) : 0;
+}
+
+static void write_snapshot (struct snapshot *s, const struct snapshot_job *job)
+{
+	struct snapshot_sample *copy;
+	unsigned long start, kept, n, i, lost;
+	char path[256], when[32], list[128], *slash;
+	struct tm tm;
+	time_t secs;
+	int64_t wall_ns;
+	FILE *fp;
+
+	// back from the trigger to pre seconds before it, or as far as is kept
+	start = job->trigger;
+	kept = oldest(s);
+	while (start > kept && s->history[(start - 1) & (s->size - 1)].t_ns >= job->trigger_ns - s->pre_ns)
+	{
+		start--;
+	}
+
+	n = job->end - start;
+	copy = malloc(n * sizeof(*copy));
+	if (copy == NULL)
+	{
+		return;
+	}
+	for (i = 0; i < n; i++)
+	{
+		copy[i] = s->history[(start + i) & (s->size - 1)];
+	}
+
+	// anything the read thread has overwritten since is dropped from the front
+	lost = oldest(s) > start ? oldest(s) - start : 0;
+	if (lost > n)
+	{
+		lost = n;
+	}
+
+	wall_ns = job->trigger_ns + s->offset_ns;
+	secs = wall_ns / 1000000000LL;
+	localtime_r(&secs, &tm);
+	strftime(when, sizeof(when), "%Y%m%d-%H%M%S", &tm);
+
+	list[0] = '\0';
+	for (i = 0; i < 8 * sizeof(job->alarmed); i++)
+	{
+		if (job->alarmed & (1u << i))
+		{
+			snprintf(list + strlen(list), sizeof(list) - strlen(list), "%s%lu", list[0] ? " " : "", i + 1);
+		}
+	}
+
+	// snapshot-<time>-ch<first channel>.csv beside the index
+	strncpy(path, s->index, sizeof(path) - 1);
+	path[sizeof(path) - 1] = '\0';
+	slash = strrchr(path, '/');
+	snprintf(slash ? slash + 1 : path, sizeof(path) - (slash ? slash + 1 - path : 0),
+			"snapshot-%s-ch%d.csv", when, __builtin_ctz(job->alarmed) + 1);
+
+	fp = fopen(path, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "vehicleMon: Can't write %s: %s\n", path, strerror(errno));
+		free(copy);
+		return;
+	}
+
+	if ((lost || (start == kept && kept > 0)) && lost < n)
+	{
+		fprintf(stderr, "vehicleMon: Snapshot %s cut short, starts %.1f s before the alarm\n",
+				path, (job->trigger_ns - copy[lost].t_ns) / 1e9);
+	}
+
+	fprintf(fp, "# alarm at %s.%03d, channels %s\n", when, (int)(wall_ns / 1000000 % 1000), list);
+	fprintf(fp, "time,channel,true_voltage,modified_voltage\n");
+	for (i = lost; i < n; i++)
+	{
+		fprintf(fp, "%.6lf,%d,%.6f,%.6f\n", (copy[i].t_ns - job->trigger_ns) / 1e9,
+				copy[i].channel + 1, copy[i].true_voltage, copy[i].value);
+	}
+	fclose(fp);
+	free(copy);
+
+	fp = fopen(s->index, "a");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "vehicleMon: Can't write %s: %s\n", s->index, strerror(errno));
+		return;
+	}
+	if (ftell(fp) == 0)
+	{
+		fprintf(fp, "time,channels,file,samples\n");
+	}
+	fprintf(fp, "%s,%s,%s,%lu\n", when, list, path, n - lost);
+	fclose(fp);
+	s->written++;
+}
+
+/*
+ * snapshot_loop:
+ *  The writer thread, it sleeps until a window closes.
+ *********************************************************************************
+ */
+
+static void *snapshot_loop (void *data)
+{
+	struct snapshot *s = data;
+	struct snapshot_job job;
+
+	for (;;)
+	{
+		while (sem_wait(&s->ready) < 0 && errno == EINTR)
+			;
+		while (ring_pop(&s->jobs, &job) == 0)
+		{
+			write_snapshot(s, &job);
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,74 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/*
+ * snapshot.h:
+ *  Alarm snapshots.  Every sample of every channel goes into an in-memory
+ *  history; when an alarm fires, the pre seconds before it and the post
+ *  seconds after it are written to a CSV file by a background thread and
+ *  listed in an index file by time and channel.  Alarms on other channels
+ *  while the post window is open join the same snapshot.
+ *
+ *  snapshot_add() and snapshot_trigger() are for the read thread only and
+ *  never block.  The history is sized for pre + post seconds at the most
+ *  samples per second the channels can give together; a snapshot cut short
+ *  all the same is reported when it is written.
+ *********************************************************************************
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "ring.h"
+#include "rtsched.h"
+
+#define SNAPSHOT_PRE 30			// default seconds before the alarm
+#define SNAPSHOT_POST 10		// default seconds after it
+
+struct snapshot_sample
+{
+	int64_t t_ns;			// CLOCK_MONOTONIC
+	int channel;			// 0 based
+	float true_voltage;
+	float value;
+};
+
+// a closed window, handed from the read thread to the writer
+struct snapshot_job
+{
+	unsigned long trigger;		// history index of the first alarm sample
+	unsigned long end;		// history index one past the last sample
+	int64_t trigger_ns;
+	unsigned int alarmed;		// bit per channel that alarmed
+};
+
+struct snapshot
+{
+	struct snapshot_sample *history;
+	unsigned long size;		// samples kept, all channels, a power of 2
+	unsigned long head;		// samples ever added, read thread writes
+	int64_t pre_ns, post_ns;
+	int64_t offset_ns;		// wall clock minus CLOCK_MONOTONIC
+	const char *index;		// index file, snapshots are written beside it
+
+	// the window being filled, read thread only
+	int open;
+	struct snapshot_job job;
+	int64_t end_ns;
+
+	struct ring jobs;
+	sem_t ready;
+	pthread_t thread;
+	long written;			// snapshots written
+	long dropped;			// windows the writer had no room for
+};
+
+int snapshot_init (struct snapshot *s, int pre_s, int post_s, double rate, const char *index,
+		const struct rtsched *sched);
+void snapshot_add (struct snapshot *s, const struct timespec *when, int channel,
+		float true_voltage, float value);
+void snapshot_trigger (struct snapshot *s, int channel);
+
+#endif /* SNAPSHOT_H */
@@ -19,14 +19,32 @@
  *
  *  Daniel Robinson, 9 April 2015
  *  Daniel Robinson, 10 June 2015
+ *
+ *  Build with -DVEHICLEMON_NO_MAIN to link the monitor into another program,
+ *  such as bench.c, which then calls setup() and start_acquisition() itself.
  ***********************************************************************
  */
 
 #define TRUE 1
 #define FALSE 0
 #define display_length 16
-#define channels 8
-#define line_length 255
+#define max_channels 32	// channel masks are unsigned long, 32 bits on the Pi
+#define display_channels 8	// channels with widgets on the display
+#define per_channel CONFSTORE_PER_CHANNEL	// a setting with a value for every channel
+#define capture_length 2400	// 10 s at 240 samples per second
+#define max_sample_rate 240	// samples per second, the most a channel gives
+#define sample_ring_length 1024	// samples waiting for the render thread
+#define render_period_ns 20000000	// render thread wakes at 50 Hz
+#define widget_interval_ns 100000000	// each widget refreshed at most at 10 Hz
+#define alarm_sound_ns 1000000000L	// alarm sound repeated at most once a second
+#define alarm_form_ns 2000000000L	// and the alarm form shown or left at most every 2 s
+#define sampler_idle_ns 10000000L	// longest read thread sleep with no channel due
+#define alarm_ring_length 64	// alarm trips and clears waiting for the main thread
+#define serial_settle_ns 1000000L	// recheck for a touch this often after serial input
+#define serial_settle_tries 2	// for up to this many times while geniePi queues it
+#define idle_check_ns 1000000000L	// main thread checks for touches at least this often
+#define serial_poll_ns 10000000L	// or this often if the serial port can't be watched
+#define scope_columns 112	// min/max pairs across a scope widget
 
 #include <stdio.h>
 #include <fcntl.h>
@@ -39,6 +57,7 @@
 #include <math.h>
 
 #include <pthread.h>
+#include <semaphore.h>
 
 #include <stdint.h>
 #include <sys/types.h>
@@ -52,6 +71,22 @@
 #include <geniePi.h>
 
 #include "adcpiv3.h"
+#include "adcsim.h"
+#include "ring.h"
+#include "genieq.h"
+#include "render.h"
+#include "recorder.h"
+#include "snapshot.h"
+#include "samplelog.h"
+#include "confstore.h"
+#include "alarm.h"
+#include "sampler.h"
+#include "evloop.h"
+#include "latency.h"
+#include "liveboard.h"
+#include "scope.h"
+#include "rtsched.h"
+#include "clockns.h"
 
 
 int current_form, previous_form, pre_previous_form;
@@ -59,24 +94,50 @@ int errorCondition;
 int current_slider = -1;
 int last_edit_button;
 int volume = 10;
-
-int slider_values[channels];
-int rocker_values[channels];
-int armed[channels];
-int alarm_activated[channels];
-
-double true_voltage[channels];
-double modified_voltage[channels];
-double gradient[channels];
-double offset[channels];
-double max[channels];
-double min[channels];
-double ref_volt_1[channels] = {0};
-double ref_volt_2[channels] = { [0 ... (channels - 1)] = 12};
-double true_volt_1[channels];
-double true_volt_2[channels];
-double alarm_max[channels];
-double alarm_min[channels];
+int channels = 8;	// in the adc layout, at most max_channels
+
+int slider_values[max_channels];
+int rocker_values[max_channels];
+int armed[max_channels];
+int alarm_activated[max_channels];
+
+double true_voltage[max_channels];
+double modified_voltage[max_channels];
+double gradient[max_channels];
+double offset[max_channels];
+double max[max_channels];
+double min[max_channels];
+double ref_volt_1[max_channels] = {0};
+double ref_volt_2[max_channels] = { [0 ... (max_channels - 1)] = 12};
+double true_volt_1[max_channels];
+double true_volt_2[max_channels];
+double alarm_max[max_channels];
+double alarm_min[max_channels];
+double alarm_hysteresis[max_channels];	// volts back inside the limits before an alarm clears
+int alarm_delay[max_channels];	// ms out of range before an alarm trips
+int alarm_mode[max_channels];	// ALARM_BAND or ALARM_INVERTED
+int resolution[max_channels] = { [0 ... (max_channels - 1)] = ADC_DEFAULT_BITS};	// 12, 14, 16 or 18 bit
+int gain[max_channels] = { [0 ... (max_channels - 1)] = ADC_DEFAULT_GAIN};	// PGA gain 1, 2, 4 or 8
+int pending_bits[max_channels];	// a mode set by setMode(), waiting for the read thread
+int pending_gain[max_channels];
+unsigned long mode_pending;	// channels with a mode in pending_bits and pending_gain, under sample_lock
+int mode_bits[max_channels] = { [0 ... (max_channels - 1)] = ADC_DEFAULT_BITS};	// read thread: the mode each channel converts in
+int mode_gain[max_channels] = { [0 ... (max_channels - 1)] = ADC_DEFAULT_GAIN};
+double sample_rate[max_channels];	// target samples per second, 0 for any spare time
+int sample_priority[max_channels];	// 0 for off, higher channels are converted first
+
+long conversion_ns[max_channels];	// time the last conversion took, request to ready bit
+
+volatile int capture_channel = -1;	// channel locked in continuous conversion, -1 if none
+float capture_buf[capture_length];
+double capture_value[capture_length];	// calibrated
+long capture_ns[capture_length];
+int capture_n;			// samples in capture_buf for the capture writer
+int capture_of;			// and the channel they are of
+volatile int capture_writing;	// the writer has capture_buf, no capture can start
+sem_t capture_ready;
+pthread_t capture_thread;
+char *capture_file = "capture.csv";
 
 const double max_volt = 2.048;
 const double min_volt = -2.048;
@@ -84,9 +145,176 @@ const double min_volt = -2.048;
 char display[display_length];
 char numberString[display_length];
 char *data_file = "data.txt";
+char *display_device = "/dev/ttyAMA0";
+char *recorder_file = "flight.rec";	// NULL for no flight recorder
+char *log_file = "samples.vsl";		// NULL for no sample log
+char *board_name = LIVEBOARD_NAME;	// NULL for no live value board
+char *layout_spec = ADC_LAYOUT;		// buses and chips, see adc_parse_layout()
 
 FILE *fp;
 
+// data_file is saved through here, see confstore.h
+struct confstore config;
+
+// which bus and chip each channel is on
+struct adc_layout layout;
+
+// an acquisition thread, one for each bus so that the buses convert in
+// parallel.  Each converts its own chips; sample_lock is held only while
+// choosing channels and handing on their samples, as the sampler, rings,
+// recorder, logs and alarms take one writer at a time.
+struct adc_worker
+{
+	struct adc_session adc;
+	int bus;			// in layout
+	pthread_t thread;
+};
+
+struct adc_worker workers[ADC_BUSES];
+pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// a calibrated sample on its way from the read thread to the render thread
+struct sample
+{
+	struct timespec when;
+	int64_t requested_ns;		// when its conversion was requested
+	int channel;
+	double true_voltage;
+	double modified_voltage;
+};
+
+struct ring sample_ring;
+
+struct recorder recorder;
+
+struct samplelog sample_log;
+
+struct alarm alarms;
+
+// a trip or clear on its way from the read thread to the main thread
+struct alarm_note
+{
+	struct alarm_event event;
+	int64_t requested_ns;		// when the conversion that decided it was requested
+	int64_t decided_ns;		// and when check_alarms() ran
+};
+
+// called from check_alarms() for every trip and clear, for replay.c
+void (*on_alarm) (const struct alarm_event *ev);
+int64_t replay_offset_ns;	// logged wall clock minus the CLOCK_MONOTONIC it is replayed as
+
+struct ring alarm_ring;
+int64_t requested_ns[max_channels];		// read thread: latest conversion of each channel
+int64_t calibrated_ns[max_channels];	// and when its value was ready
+int64_t sampled_ns[max_channels];		// and the time it is a sample of
+int latest_code[max_channels];		// and its raw code
+int64_t trip_requested[max_channels];	// main thread: trips not yet sounded, 0 if none
+int64_t trip_decided[max_channels];
+unsigned long alarm_dropped;	// alarm_ring.dropped when show_alarms() last caught up
+int64_t alarm_sound_at;		// when the alarm sound was last played
+int64_t trip_sound_at[max_channels];	// and last played for a new trip of each channel
+int64_t alarm_form_at;		// when the alarm form was last shown or left
+int alarm_form_shown;		// the alarm form is up because of an alarm, not the user
+const struct alarm_rules alarm_rules =
+{
+	alarm_max, alarm_min, alarm_hysteresis, alarm_delay, alarm_mode, armed
+};
+
+// which channel each chip converts next, see sampler.h
+struct sampler sampler;
+
+struct snapshot snapshot;
+char *snapshot_index = "snapshots.csv";	// alarm snapshots are written beside it
+int snapshot_pre = SNAPSHOT_PRE;	// seconds kept before an alarm
+int snapshot_post = SNAPSHOT_POST;	// and after it
+
+// every write to the display goes through here, see genieq.h
+struct genieq genie_q;
+
+// what the main thread sleeps on, see evloop.h
+struct evloop events;
+
+// latest values for other processes, see liveboard.h
+struct liveboard board;
+
+// stage by stage latency, written to latency_file on SIGUSR1
+struct latency latency;
+char *latency_file = "latency.csv";
+
+struct render render;
+long serial_budget = RENDER_DEFAULT_BUDGET;	// bytes per second for routine updates
+struct scope scopes[2];		// channels 1-4 and 5-8, render thread only
+int scope_window = 10;		// seconds across the scopes, 10 or 60
+
+// the threads given their own scheduling, see rtsched.h
+enum op_thread
+{
+	THREAD_ACQUISITION,		// adc_read_loop(), one per bus
+	THREAD_RENDER,			// render_loop()
+	THREAD_LOGGER,			// flight recorder, sample log, snapshot and capture writers
+	threads
+};
+
+int thread_policy[threads];	// enum rtsched_policy
+int thread_priority[threads];	// 1 to 99 for RTSCHED_FIFO and RTSCHED_RR
+long thread_cpus[threads];	// bit per CPU, RTSCHED_ANY_CPU to run on any
+int lock_memory = TRUE;		// mlockall, so no thread waits on a page fault
+
+// resolutions and gains the MCP3424 has, any other is not a mode
+static int valid_resolution (double v)
+{
+	__u8 config;
+	float multiplier;
+
+	return v == (int)v && adc_config(1, (int)v, ADC_DEFAULT_GAIN, &config, &multiplier) == 0;
+}
+
+static int valid_gain (double v)
+{
+	__u8 config;
+	float multiplier;
+
+	return v == (int)v && adc_config(1, ADC_DEFAULT_BITS, (int)v, &config, &multiplier) == 0;
+}
+
+// the sections of data_file, with the value used when one is missing or
+// not valid
+const struct confstore_field settings[] =
+{
+	{ "gradient",      CONFSTORE_DOUBLE, gradient,       per_channel, 1,      -1e6, 1e6 },
+	{ "offset",        CONFSTORE_DOUBLE, offset,         per_channel, 0,      -1e6, 1e6 },
+	{ "max",           CONFSTORE_DOUBLE, max,            per_channel, 2.048,  -1e6, 1e6 },
+	{ "min",           CONFSTORE_DOUBLE, min,            per_channel, -2.048, -1e6, 1e6 },
+	{ "ref_volt_1",    CONFSTORE_DOUBLE, ref_volt_1,     per_channel, 0,      -1e6, 1e6 },
+	{ "ref_volt_2",    CONFSTORE_DOUBLE, ref_volt_2,     per_channel, 12,     -1e6, 1e6 },
+	{ "alarm_max",     CONFSTORE_DOUBLE, alarm_max,      per_channel, 5,      -1e6, 1e6 },
+	{ "alarm_min",     CONFSTORE_DOUBLE, alarm_min,      per_channel, -5,     -1e6, 1e6 },
+	{ "alarm_hysteresis", CONFSTORE_DOUBLE, alarm_hysteresis, per_channel, 0,  0, 1e6 },
+	{ "alarm_delay",   CONFSTORE_INT,    alarm_delay,    per_channel, 0,      0, 60000 },
+	{ "alarm_mode",    CONFSTORE_INT,    alarm_mode,     per_channel, ALARM_BAND, ALARM_BAND, ALARM_INVERTED },
+	{ "armed",         CONFSTORE_INT,    armed,          per_channel, FALSE,  0, 1 },
+	{ "volume",        CONFSTORE_INT,    &volume,        1,           10,     0, 100 },
+	{ "resolution",    CONFSTORE_INT,    resolution,     per_channel, ADC_DEFAULT_BITS, 12, 18, valid_resolution },
+	{ "gain",          CONFSTORE_INT,    gain,           per_channel, ADC_DEFAULT_GAIN, 1, 8, valid_gain },
+	{ "sample_rate",   CONFSTORE_DOUBLE, sample_rate,    per_channel, 0,      0, max_sample_rate },
+	{ "sample_priority", CONFSTORE_INT,  sample_priority, per_channel, 1,     0, 9 },
+	{ "serial_budget", CONFSTORE_LONG,   &serial_budget, 1,           RENDER_DEFAULT_BUDGET, 100, RENDER_BAUD_BYTES },
+	{ "snapshot_pre",  CONFSTORE_INT,    &snapshot_pre,  1,           SNAPSHOT_PRE,  0, 120 },
+	{ "snapshot_post", CONFSTORE_INT,    &snapshot_post, 1,           SNAPSHOT_POST, 0, 120 },
+	{ "scope_window",  CONFSTORE_INT,    &scope_window,  1,           10,     10, 60 },
+	{ "acquisition_policy",   CONFSTORE_INT,  &thread_policy[THREAD_ACQUISITION],   1, RTSCHED_RR,    RTSCHED_OTHER, RTSCHED_RR },
+	{ "acquisition_priority", CONFSTORE_INT,  &thread_priority[THREAD_ACQUISITION], 1, 10,            0, 99 },
+	{ "acquisition_cpus",     CONFSTORE_LONG, &thread_cpus[THREAD_ACQUISITION],     1, RTSCHED_ANY_CPU, 0, 0x7fffffff },
+	{ "render_policy",        CONFSTORE_INT,  &thread_policy[THREAD_RENDER],        1, RTSCHED_OTHER, RTSCHED_OTHER, RTSCHED_RR },
+	{ "render_priority",      CONFSTORE_INT,  &thread_priority[THREAD_RENDER],      1, 0,             0, 99 },
+	{ "render_cpus",          CONFSTORE_LONG, &thread_cpus[THREAD_RENDER],          1, RTSCHED_ANY_CPU, 0, 0x7fffffff },
+	{ "logger_policy",        CONFSTORE_INT,  &thread_policy[THREAD_LOGGER],        1, RTSCHED_OTHER, RTSCHED_OTHER, RTSCHED_RR },
+	{ "logger_priority",      CONFSTORE_INT,  &thread_priority[THREAD_LOGGER],      1, 0,             0, 99 },
+	{ "logger_cpus",          CONFSTORE_LONG, &thread_cpus[THREAD_LOGGER],          1, RTSCHED_ANY_CPU, 0, 0x7fffffff },
+	{ "lock_memory",   CONFSTORE_INT,    &lock_memory,   1,           TRUE,   0, 1 }
+};
+const int settings_count = sizeof(settings) / sizeof(settings[0]);
+
 enum op_form 
 {
 	HOME,
@@ -120,8 +348,8 @@ enum op_channel
 	ROCKER_CH_8 = 20
 };
 
-int slider[channels] = {CH_1, CH_2, CH_3, CH_4, CH_5, CH_6, CH_7, CH_8};
-int rocker[channels] = {ROCKER_CH_1, ROCKER_CH_2, ROCKER_CH_3, ROCKER_CH_4, ROCKER_CH_5, ROCKER_CH_6, ROCKER_CH_7, ROCKER_CH_8};
+int slider[display_channels] = {CH_1, CH_2, CH_3, CH_4, CH_5, CH_6, CH_7, CH_8};
+int rocker[display_channels] = {ROCKER_CH_1, ROCKER_CH_2, ROCKER_CH_3, ROCKER_CH_4, ROCKER_CH_5, ROCKER_CH_6, ROCKER_CH_7, ROCKER_CH_8};
 
 enum win_button
 {
@@ -144,7 +372,11 @@ enum win_button
 	BUT__ALARM = 25,
 	BUT__ALARM_DISARM_ALL = 27,
 	BUT_REBOOT = 30,
-	BUT_SHUTDOWN = 31
+	BUT_SHUTDOWN = 31,
+	BUT_RESOLUTION = 32,
+	BUT_GAIN = 33,
+	BUT_CAPTURE = 34,
+	BUT_SCOPE_WINDOW = 35
 };
 
 enum button_4D
@@ -162,9 +394,22 @@ enum keys
 };
 
 
-void updateDisplay (double val, int index);
+void updateDisplay (double val, int index, int64_t origin_ns, int64_t at_ns);
 int setup(void);
+int start_acquisition (const struct adc_backend *backend, const char *bus);
+long replay_log (const char *path, double speed);
+static int open_outputs (const struct rtsched *logger);
 static void *adc_read_loop (void *data);
+static void apply_modes (struct adc_worker *w);
+static void process_sample (int j, float val, int code, int64_t requested, int64_t ready, int64_t at);
+static void frame_sent (const struct genieq_cmd *c, int64_t sent_ns);
+void write_latency (void);
+static void check_alarms (unsigned long fresh, int64_t at);
+static int64_t show_alarms (int64_t now);
+void *event_loop (void *data);
+static void capture (struct adc_worker *w);
+static void *capture_loop (void *data);
+static void *render_loop (void *data);
 void handleGenieEvent (struct genieReplyStruct *reply);
 void updateForm(int form);
 void updateNumpadDisplay (void);
@@ -177,6 +422,7 @@ void reset(void);
 void reset_alarm_min_max(void);
 void save_to_file(void);
 void updateRange(void);
+int setMode(int i);
 
 /*
  *********************************************************************************
@@ -185,427 +431,1039 @@ void updateRange(void);
  *********************************************************************************
  */
 
+#ifndef VEHICLEMON_NO_MAIN
 int main(int argc, char **argv) {
-	int i, j, channel;
-	pthread_t myThread;
-	struct genieReplyStruct reply;
+	int opt;
+	char *adc_spec = NULL;
+
+	// -s spec: use the simulated adc instead of the i2c bus, see adcsim.h
+	// -d device: serial port of the display, e.g. the pty of simDisplay
+	// -r file: flight recorder file, see recorder.h
+	// -l file: sample log, see samplelog.h
+	// -b name: shared memory live value board, see liveboard.h
+	// -m layout: adc buses and chip addresses, see adc_parse_layout()
+	while ((opt = getopt(argc, argv, "s:d:r:l:b:m:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			adc_spec = optarg;
+			break;
+		case 'd':
+			display_device = optarg;
+			break;
+		case 'r':
+			recorder_file = optarg;
+			break;
+		case 'l':
+			log_file = optarg;
+			break;
+		case 'b':
+			board_name = optarg;
+			break;
+		case 'm':
+			layout_spec = optarg;
+			break;
+		default:
+			fprintf (stderr, "Usage: %s [-s adc_sim_spec] [-d display_device] [-r recorder_file] [-l log_file] [-b board_name] [-m adc_layout]\n", argv[0]);
+			return 1;
+		}
+	}
 
-	setup();
+	if (setup() != 0)
+	{
+		return 1;
+	}
 
-	// setup multiplier based on input voltage range and divisor
-	// removed 2.4705882 constant in place of 1 
-	varMultiplier = (1 / varDivisior) / 1000;
+	if (adc_spec)
+	{
+		if (start_acquisition (&adc_sim, adc_spec) < 0)
+		{
+			return 1;
+		}
+	}
+	else if (start_acquisition (&adc_i2c, NULL) < 0)
+	{
+		return 1;
+	}
 
-	// possibly useful code
-	if (argc > 1) channel = atoi(argv[1]);
-	if (channel < 1 | channel > 8) channel = 1;
+	event_loop (NULL);
+	return 0;
+}
+#endif /* VEHICLEMON_NO_MAIN */
 
-	// start adc read thread
-	(void)pthread_create (&myThread, NULL, adc_read_loop, NULL);
+/*
+ * start_acquisition:
+ *  Open every bus of the layout and everything the samples go to, apply
+ *  the per-channel modes and start a read thread for each bus and the
+ *  render thread.  The buses are opened as the layout's devices if bus is
+ *  NULL, or all as bus otherwise, e.g. the spec of the simulated adc.
+ *  Each bus stays open for the lifetime of its read thread.  The read,
+ *  render and logging threads are started on the policy, priority and
+ *  CPUs set for them in data_file, see rtsched_create(), and memory is
+ *  locked once they are all running if lock_memory is set.
+ *
+ *  @return: 0 on success or -1 if a bus could not be opened.
+ *********************************************************************************
+ */
 
-	// touchscreen event loop
-	for (;;)
+int start_acquisition (const struct adc_backend *backend, const char *bus)
+{
+	int i, b, t;
+	const char *device;
+	char name[80];
+	pthread_t renderThread;
+	struct rtsched sched[threads];
+
+	for (t = 0; t < threads; t++)
 	{
-		while (genieReplyAvail())
+		sched[t].policy = thread_policy[t];
+		sched[t].priority = thread_priority[t];
+		sched[t].cpus = thread_cpus[t];
+	}
+
+	for (b = 0; b < layout.buses; b++)
+	{
+		device = bus ? bus : layout.bus[b];
+		workers[b].bus = b;
+		if (adc_open_backend (&workers[b].adc, backend, device) < 0)
 		{
-			genieGetReply    (&reply);
-			handleGenieEvent (&reply);
+			fprintf (stderr, "vehicleMon: Can't open %s: %s\n", device, strerror (errno));
+			return -1;
 		}
-		usleep (10000); // 10mS - Don't hog the CPU in-case anything else is happening...
+	}
+
+	if (open_outputs (&sched[THREAD_LOGGER]) < 0)
+	{
+		return -1;
+	}
+
+	if (sampler_init (&sampler, channels, sample_rate, sample_priority, &alarm_rules, modified_voltage) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't allocate sampler\n");
+		return -1;
+	}
+
+	for (i = 0; i < channels; i++)
+	{
+		setMode(i);
+	}
+
+	// start the adc read threads, the render thread that shows their samples
+	// and the writer of their captures
+	sem_init (&capture_ready, 0, 0);
+	(void)rtsched_create (&capture_thread, "capture", &sched[THREAD_LOGGER], capture_loop, NULL);
+	for (b = 0; b < layout.buses; b++)
+	{
+		snprintf (name, sizeof(name), "acquisition %s", layout.bus[b]);
+		(void)rtsched_create (&workers[b].thread, name, &sched[THREAD_ACQUISITION], adc_read_loop, &workers[b]);
+	}
+	(void)rtsched_create (&renderThread, "render", &sched[THREAD_RENDER], render_loop, NULL);
+
+	// with every stack and mapping there, so those are what is locked
+	if (lock_memory)
+	{
+		rtsched_lock_memory ();
 	}
 	return 0;
 }
 
+/*
+ * open_outputs:
+ *  Set up what a sample goes through after the adc: the rings to the
+ *  render and main threads, the flight recorder, sample log, live value
+ *  board, snapshots, alarms and latency histograms.  Monitoring goes on
+ *  without the recorder, log, board or snapshots if they cannot be opened.
+ *  Their writer threads are scheduled as logger, see rtsched_create().
+ *
+ *  @return: 0 on success or -1 if the rings or alarms could not be set up.
+ *********************************************************************************
+ */
+
+static int open_outputs (const struct rtsched *logger)
+{
+	if (ring_init (&sample_ring, sizeof(struct sample), sample_ring_length) < 0 ||
+			ring_init (&alarm_ring, sizeof(struct alarm_note), alarm_ring_length) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't allocate sample ring\n");
+		return -1;
+	}
+
+	if (recorder_file && recorder_open (&recorder, recorder_file, RECORDER_DEFAULT_BYTES, logger) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't open flight recorder %s: %s\n", recorder_file, strerror (errno));
+	}
+
+	if (snapshot_index && snapshot_init (&snapshot, snapshot_pre, snapshot_post,
+			channels * (double)max_sample_rate, snapshot_index, logger) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't allocate alarm snapshots\n");
+	}
+
+	if (board_name && liveboard_create (&board, board_name, channels) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't create live value board %s: %s\n", board_name, strerror (errno));
+	}
+
+	if (latency_init (&latency, channels) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't allocate latency histograms\n");
+	}
+
+	if (alarm_init (&alarms, channels, &alarm_rules) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't allocate alarm state\n");
+		return -1;
+	}
+
+	if (log_file && samplelog_open (&sample_log, log_file, channels, gradient, offset, logger) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't open sample log %s: %s\n", log_file, strerror (errno));
+	}
+	return 0;
+}
+
+/*
+ * replay_log:
+ *  Feed a sample log through the same calibration, alarms and display as
+ *  adc_read_loop(), in the calling thread, with the calibration and alarm
+ *  settings now loaded rather than those it was logged with.  Alarm delays
+ *  run on the logged times, so the alarms come out the same at any speed.
+ *  speed 1 replays in real time, 10 ten times as fast and 0 as fast as
+ *  the samples can be processed; the display is only sent what it can
+ *  keep up with.  Replayed samples are given CLOCK_MONOTONIC times
+ *  replay_offset_ns before their logged wall clock times, so snapshots and
+ *  a sample log written from them get the original times back.  Call
+ *  after setup(), with the recorder, sample log and board switched off
+ *  unless they are wanted.
+ *
+ *  @return: the samples replayed, or -1 if the log could not be opened.
+ *********************************************************************************
+ */
+
+long replay_log (const char *path, double speed)
+{
+	struct samplelog_reader reader;
+	struct samplelog_sample s;
+	struct timespec until;
+	pthread_t renderThread;
+	int64_t first = 0, start, now, due;
+	long n = 0;
+
+	if (samplelog_reader_open (&reader, path) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't open sample log %s: %s\n", path, strerror (errno));
+		return -1;
+	}
+
+	if (open_outputs (NULL) < 0)
+	{
+		samplelog_reader_close (&reader);
+		return -1;
+	}
+	(void)pthread_create (&renderThread, NULL, render_loop, NULL);
+
+	start = clock_ns(CLOCK_MONOTONIC);
+	replay_offset_ns = clock_ns(CLOCK_REALTIME) - start;
+	while (samplelog_next (&reader, &s) == 1)
+	{
+		if (s.channel < 0 || s.channel >= channels)
+		{
+			continue;
+		}
+
+		if (n == 0)
+		{
+			first = s.t_ns;
+		}
+		if (speed > 0)
+		{
+			due = start + (int64_t)((s.t_ns - first) / speed);
+			until.tv_sec = due / 1000000000LL;
+			until.tv_nsec = due % 1000000000LL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+		}
+
+		// there is no conversion to time, the rest is timed as it runs.
+		// The sample is recorded in the mode it was logged in
+		now = clock_ns(CLOCK_MONOTONIC);
+		mode_bits[s.channel] = s.bits;
+		mode_gain[s.channel] = s.gain;
+		process_sample(s.channel, s.true_voltage, s.code, now, now, s.t_ns - replay_offset_ns);
+		check_alarms(1UL << s.channel, s.t_ns - replay_offset_ns);
+		n++;
+	}
+
+	if (reader.skipped)
+	{
+		fprintf (stderr, "vehicleMon: %ld damaged blocks skipped in %s\n", reader.skipped, path);
+	}
+	samplelog_reader_close (&reader);
+	return n;
+}
+
 int setup(void)
 {
 	int i;
-	char *line;
-	const char t[2] = ",";
-	char *token;
+	const char *source;
+
+	// the number of channels sizes everything that follows
+	i = adc_parse_layout (layout_spec, &layout);
+	if (i < 0 || i > max_channels)
+	{
+		fprintf (stderr, "vehicleMon: Bad adc layout \"%s\", up to %d channels\n", layout_spec, max_channels);
+		return 1;
+	}
+	channels = i;
+
+	// before any thread is started, so that none is given an 8 MB stack
+	rtsched_stack (RTSCHED_STACK);
+
+	// before any thread is started, so that they all leave SIGUSR1 to it
+	if (evloop_init (&events, display_device) < 0 || evloop_signal (&events, SIGUSR1) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't set up main loop: %s\n", strerror (errno));
+		return 1;
+	}
+	if (events.notifyfd < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't watch %s, polling it for touches\n", display_device);
+	}
 
 	// Genie display setup
-	// Using the Raspberry Pi's on-board serial port.
-	if (genieSetup ("/dev/ttyAMA0", 115200) < 0)
+	// Using the Raspberry Pi's on-board serial port unless told otherwise.
+	if (genieSetup (display_device, 115200) < 0)
 	{
 		fprintf (stderr, "rgb: Can't initialise Genie Display: %s\n", strerror (errno));
 		return 1;
 	}
 
+	if (genieq_start (&genie_q, frame_sent) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't start display writer\n");
+		return 1;
+	}
+
 	// volume
-	genieWriteObj(GENIE_OBJ_SOUND, 1, volume);
+	genieq_obj(&genie_q, GENIEQ_NORMAL, GENIE_OBJ_SOUND, 1, volume);
 
 	// Select form 0, Home
-	genieWriteObj (GENIE_OBJ_FORM, 0, 0);
+	genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, 0, 0);
+
+	genieq_obj (&genie_q, GENIEQ_NORMAL, GENIE_OBJ_4DBUTTON, CH_1, 0);
+	genieq_obj (&genie_q, GENIEQ_NORMAL, GENIE_OBJ_4DBUTTON, CH_2, 0);
+	genieq_obj (&genie_q, GENIEQ_NORMAL, GENIE_OBJ_4DBUTTON, CH_3, 0);
+	genieq_obj (&genie_q, GENIEQ_NORMAL, GENIE_OBJ_4DBUTTON, CH_4, 0);
+	genieq_obj (&genie_q, GENIEQ_NORMAL, GENIE_OBJ_4DBUTTON, CH_5, 0);
+	genieq_obj (&genie_q, GENIEQ_NORMAL, GENIE_OBJ_4DBUTTON, CH_6, 0);
+	genieq_obj (&genie_q, GENIEQ_NORMAL, GENIE_OBJ_4DBUTTON, CH_7, 0);
+	genieq_obj (&genie_q, GENIEQ_NORMAL, GENIE_OBJ_4DBUTTON, CH_8, 0);
+
+	// init
+
+	for(i = 0; i < channels; i++)
+	{
+		alarm_activated[i] = 0;
+		if (i < display_channels)
+		{
+			genieq_obj(&genie_q, GENIEQ_NORMAL, GENIE_OBJ_USER_LED, i, 0);
+			genieq_obj(&genie_q, GENIEQ_NORMAL, GENIE_OBJ_4DBUTTON, rocker[i], 0);
+		}
+	}
+
+	if (confstore_start (&config, data_file) < 0)
+	{
+		fprintf (stderr, "vehicleMon: Can't start settings writer\n");
+		return 1;
+	}
+
+	// the newest complete copy of data_file, anything it lacks keeps its default
+	source = confstore_pick (&config);
+	if (confstore_load (source, settings, settings_count, channels) != 0)
+	{
+		fprintf (stderr, "vehicleMon: Some settings in %s were not valid, using defaults for them\n", data_file);
+	}
+
+	// the scope and bar ranges are divided by, they cannot be empty
+	for (i = 0; i < channels; i++)
+	{
+		if (max[i] <= min[i])
+		{
+			max[i] = max_volt;
+			min[i] = min_volt;
+		}
+	}
+
+	if (source == NULL)
+	{
+		save_to_file();
+	}
+	printf("volume: %d\n", volume);
+
+    // volume
+	genieq_obj(&genie_q, GENIEQ_NORMAL, GENIE_OBJ_SOUND, 1, volume);
+
+	return 0;
+}
+
+/*
+ * adc_read_loop:
+ *  Read one bus's adc values within a separate thread.  The sampler picks
+ *  the next channel for each chip on the bus, and every chip converts at
+ *  once; when none has a channel due the thread sleeps until one does.
+ *********************************************************************************
+ */
+
+static void *adc_read_loop (void *data)
+{
+	struct adc_worker *w = data;
+	struct adc_session *adc = &w->adc;
+	int j, c, b, due;
+	int chips = layout.chips[w->bus];
+	int first = layout.first[w->bus];
+	int chn[ADC_CHIPS];
+	int input[ADC_CHIPS];
+	int ok[ADC_CHIPS];
+	float val[ADC_CHIPS];
+	struct adc_conversion *conv;
+	unsigned long fresh;
+	int64_t now, wake, requested;
+	struct timespec until;
+
+	// its real-time priority is set by start_acquisition()
+	for (;;)
+	{
+		if (capture_channel >= 0)
+		{
+			capture(w);
+		}
+
+		// each chip has four channels of its own, so every chip on the
+		// bus converts at once, each the channel the sampler wants next
+		pthread_mutex_lock(&sample_lock);
+		apply_modes(w);
+		now = clock_ns(CLOCK_MONOTONIC);
+		wake = now + sampler_idle_ns;
+		for (c = 0, due = 0; c < chips; c++)
+		{
+			chn[c] = sampler_next(&sampler, first + 4 * c, 4, now, &wake);
+			due |= chn[c] >= 0;
+		}
+		pthread_mutex_unlock(&sample_lock);
+
+		if (!due)
+		{
+			until.tv_sec = wake / 1000000000LL;
+			until.tv_nsec = wake % 1000000000LL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+			continue;
+		}
+
+		// start every chip before waiting for any
+		for (c = 0; c < chips; c++)
+		{
+			input[c] = chn[c] >= 0 ? adc_layout_input(&layout, chn[c], &b) : 0;
+			ok[c] = chn[c] >= 0 && adc_start(adc, input[c]) == 0;
+		}
+
+		for (c = 0; c < chips; c++)
+		{
+			ok[c] = ok[c] && adc_collect(adc, input[c], &val[c], &conversion_ns[chn[c]]) == 0;
+		}
+
+		fresh = 0;
+		pthread_mutex_lock(&sample_lock);
+		now = clock_ns(CLOCK_MONOTONIC);
+		for (c = 0; c < chips; c++)
+		{
+			if (chn[c] >= 0)
+			{
+				if (ok[c])	// otherwise keep the last good sample
+				{
+					conv = &adc->chip[layout.address[w->bus][c] - ADC_1];
+					requested = (int64_t)conv->started.tv_sec * 1000000000LL + conv->started.tv_nsec;
+					process_sample(chn[c], val[c], conv->code, requested,
+							requested + conversion_ns[chn[c]], now);
+					fresh |= 1UL << chn[c];
+				}
+				sampler_done(&sampler, chn[c], now);
+			}
+		}
+		check_alarms(fresh, clock_ns(CLOCK_MONOTONIC));
+
+		if (sampler_report(&sampler, now) && sampler.missing)
+		{
+			for (j = 0; j < channels; j++)
+			{
+				if (sampler.missing & (1UL << j))
+				{
+					fprintf (stderr, "vehicleMon: channel %d sampled at %.1f Hz, target %.1f Hz\n",
+							j + 1, sampler.achieved[j], sample_rate[j]);
+				}
+			}
+		}
+		pthread_mutex_unlock(&sample_lock);
+		// printf("\n");
+	}
+
+	return (void *)NULL;
+}
+
+/*
+ * apply_modes:
+ *  Put the modes setMode() has left for this bus's channels into its adc
+ *  session, between conversions so that none is started in one mode and
+ *  scaled in another.  Call with sample_lock held.
+ *********************************************************************************
+ */
+
+static void apply_modes (struct adc_worker *w)
+{
+	int j, bus, input;
+	int first = layout.first[w->bus];
+	int last = first + 4 * layout.chips[w->bus];
+
+	for (j = first; j < last && mode_pending; j++)
+	{
+		if (mode_pending & (1UL << j))
+		{
+			input = adc_layout_input(&layout, j, &bus);
+			adc_set_mode(&w->adc, input, pending_bits[j], pending_gain[j]);
+			mode_bits[j] = pending_bits[j];
+			mode_gain[j] = pending_gain[j];
+			mode_pending &= ~(1UL << j);
+		}
+	}
+}
+
+/*
+ * capture:
+ *  Stream one channel at the chip's full rate until the capture is stopped
+ *  or the buffer is full, then hand it to capture_loop() to write out.
+ *  Each value goes through the calibration, recorder, log and alarms like
+ *  any other sample.  Only the worker of the channel's bus does anything;
+ *  the other channels on that bus are not sampled meanwhile.
+ *********************************************************************************
+ */
 
-	genieWriteObj (GENIE_OBJ_4DBUTTON, CH_1, 0);
-	genieWriteObj (GENIE_OBJ_4DBUTTON, CH_2, 0);
-	genieWriteObj (GENIE_OBJ_4DBUTTON, CH_3, 0);
-	genieWriteObj (GENIE_OBJ_4DBUTTON, CH_4, 0);
-	genieWriteObj (GENIE_OBJ_4DBUTTON, CH_5, 0);
-	genieWriteObj (GENIE_OBJ_4DBUTTON, CH_6, 0);
-	genieWriteObj (GENIE_OBJ_4DBUTTON, CH_7, 0);
-	genieWriteObj (GENIE_OBJ_4DBUTTON, CH_8, 0);
+static void capture (struct adc_worker *w)
+{
+	int n, bus, input, bits;
+	int j = capture_channel;
+	float val;
+	struct adc_conversion *conv;
+	int64_t start, requested, now;
+
+	if (j < 0 || j >= channels)
+	{
+		return;
+	}
+	input = adc_layout_input(&layout, j, &bus);
+	if (bus != w->bus)
+	{
+		return;
+	}
+	if (capture_writing)
+	{
+		capture_channel = -1;
+		return;
+	}
+
+	n = 0;
+	if (adc_capture_start(&w->adc, input, ADC_CAPTURE_BITS) == 0)
+	{
+		conv = &w->adc.chip[(input - 1) / 4];
+		pthread_mutex_lock(&sample_lock);
+		bits = mode_bits[j];
+		mode_bits[j] = ADC_CAPTURE_BITS;
+		pthread_mutex_unlock(&sample_lock);
+
+		start = requested = clock_ns(CLOCK_MONOTONIC);
+		while (capture_channel == j && n < capture_length)
+		{
+			if (adc_capture_next(&w->adc, input, &val) < 0)
+			{
+				break;
+			}
+
+			// the chip converts continuously, so each result is timed from the last
+			pthread_mutex_lock(&sample_lock);
+			now = clock_ns(CLOCK_MONOTONIC);
+			process_sample(j, val, conv->code, requested, now, now);
+			check_alarms(1UL << j, now);
+			capture_ns[n] = now - start;
+			capture_buf[n] = val;
+			capture_value[n++] = modified_voltage[j];
+			pthread_mutex_unlock(&sample_lock);
+			requested = now;
+		}
+
+		pthread_mutex_lock(&sample_lock);
+		mode_bits[j] = bits;
+		pthread_mutex_unlock(&sample_lock);
+	}
+	capture_channel = -1;
+
+	printf("capture: %d samples from channel %d\n", n, j + 1);
+
+	capture_n = n;
+	capture_of = j;
+	capture_writing = TRUE;
+	sem_post(&capture_ready);
+}
+
+/*
+ * capture_loop:
+ *  The capture writer thread, it sleeps until capture() has a buffer for
+ *  capture_file, so the read thread goes back to its sweep at once.
+ *********************************************************************************
+ */
+
+static void *capture_loop (void *data)
+{
+	FILE *cf;
+	int i;
+
+	for (;;)
+	{
+		while (sem_wait(&capture_ready) < 0 && errno == EINTR)
+			;
+
+		cf = fopen(capture_file, "w");
+		if (cf == NULL)
+		{
+			fprintf (stderr, "vehicleMon: Can't write %s: %s\n", capture_file, strerror (errno));
+		}
+		else
+		{
+			fprintf(cf, "# channel %d\n", capture_of + 1);
+			fprintf(cf, "time,true_voltage,modified_voltage\n");
+			for (i = 0; i < capture_n; i++)
+			{
+				fprintf(cf, "%.6lf,%.6lf,%.6lf\n", capture_ns[i] / 1e9, capture_buf[i], capture_value[i]);
+			}
+			fclose(cf);
+		}
+		capture_writing = FALSE;
+	}
+	return NULL;
+}
+
+/*
+ * process_sample:
+ *  Calibrate a new reading, record it and show it.  requested and ready
+ *  are when its conversion was asked for and seen to be done, at the time
+ *  it is a sample of, all CLOCK_MONOTONIC.
+ *********************************************************************************
+ */
+
+static void process_sample (int j, float val, int code, int64_t requested, int64_t ready, int64_t at)
+{
+	struct sample sample;
+
+	true_voltage[j] = val;
+	modified_voltage[j] = gradient[j] * true_voltage[j] + offset[j];
+	// printf ("Channel: %d  = %2.4fV\n", j + 1, modified_voltage[j]);
+
+	sample.when.tv_sec = at / 1000000000LL;
+	sample.when.tv_nsec = at % 1000000000LL;
+	sampled_ns[j] = at;
+	requested_ns[j] = sample.requested_ns = requested;
+	calibrated_ns[j] = clock_ns(CLOCK_MONOTONIC);
+	latest_code[j] = code;
+	if (ready > requested)		// a replayed sample has no conversion
+	{
+		latency_add(&latency, LATENCY_CONVERSION, j, ready - requested);
+	}
+	latency_add(&latency, LATENCY_CALIBRATION, j, calibrated_ns[j] - ready);
+
+	recorder_write(&recorder, j, mode_bits[j], mode_gain[j], code, true_voltage[j], modified_voltage[j]);
+	snapshot_add(&snapshot, &sample.when, j, true_voltage[j], modified_voltage[j]);
+	samplelog_add(&sample_log, &sample.when, j, mode_bits[j], mode_gain[j], code);
+
+	// hand the sample to the render thread, if it has fallen behind this
+	// sample is dropped from the display rather than delaying the next one
+	sample.channel = j;
+	sample.true_voltage = true_voltage[j];
+	sample.modified_voltage = modified_voltage[j];
+	ring_push(&sample_ring, &sample);
+	
+	// genieWriteObj(GENIE_OBJ_SCOPE, j < 4 ? 0 : 1, (int)(true_voltage[j]*25 + 50));
+}
+
+/*
+ * event_loop:
+ *  The main thread.  Sleeps until a touch comes in from the display, the
+ *  read thread has alarm changes for it, one of its own deadlines is due
+ *  or SIGUSR1 asks for the latency histograms, instead of polling.  geniePi reads the serial port itself, so after
+ *  it has read something the replies are looked for again a few times,
+ *  serial_settle_ns apart, in case a touch is still being queued.  If the
+ *  port could not be watched, replies are polled every serial_poll_ns.
+ *********************************************************************************
+ */
+
+void *event_loop (void *data)
+{
+	struct genieReplyStruct reply;
+	int ready, handled, settle = 0;
+	int64_t now, next;
+
+	for (;;)
+	{
+		ready = evloop_wait (&events);
+		if (ready < 0)
+		{
+			fprintf (stderr, "vehicleMon: Main loop failed: %s\n", strerror (errno));
+			return NULL;
+		}
+		if (ready & EVLOOP_SERIAL)
+		{
+			settle = serial_settle_tries;
+		}
+		if (ready & EVLOOP_SIGNAL)
+		{
+			write_latency ();
+		}
+
+		handled = 0;
+		while (genieReplyAvail())
+		{
+			genieGetReply    (&reply);
+			handleGenieEvent (&reply);
+			handled = 1;
+		}
+		settle = handled ? 0 : settle;
+
+		now = clock_ns(CLOCK_MONOTONIC);
+		next = show_alarms(now);
+		if (next == 0 || now + idle_check_ns < next)
+		{
+			next = now + idle_check_ns;
+		}
+		if (settle > 0 && now + serial_settle_ns < next)
+		{
+			settle--;
+			next = now + serial_settle_ns;
+		}
+		if (events.notifyfd < 0 && now + serial_poll_ns < next)
+		{
+			next = now + serial_poll_ns;
+		}
+		evloop_timer (&events, next);
+	}
+	return NULL;
+}
 
-	// init
+/*
+ * frame_sent:
+ *  Called by the display writer after each frame, to time those that show
+ *  a sample.
+ *********************************************************************************
+ */
 
-	for(i = 0; i < channels; i++)
+static void frame_sent (const struct genieq_cmd *c, int64_t sent_ns)
+{
+	if (c->channel < 0)
 	{
-		alarm_activated[i] = 0;
-		genieWriteObj(GENIE_OBJ_USER_LED, i, 0);
-		genieWriteObj(GENIE_OBJ_4DBUTTON, rocker[i], 0);
+		return;
 	}
 
-	if( access( data_file, F_OK ) == -1 )
+	latency_add(&latency, LATENCY_WRITE, c->channel, sent_ns - c->queued_ns);
+	if (c->object == GENIE_OBJ_SOUND)
 	{
-	   reset();
-	   reset_alarm_min_max();
-	   save_to_file();
+		latency_add(&latency, LATENCY_ALARM_TOTAL, c->channel, sent_ns - c->origin_ns);
 	}
+	else
+	{
+		latency_add(&latency, LATENCY_READING_TOTAL, c->channel, sent_ns - c->origin_ns);
+	}
+}
 
-	fp = fopen(data_file, "r+");
-
-	//
-	// gradient
-	//
-	line = calloc(line_length, sizeof(char));
+/*
+ * write_latency:
+ *  Write the latency histograms' quantiles to latency_file.
+ *********************************************************************************
+ */
 
-	fgets(line, line_length, fp);
-	fgets(line, line_length, fp);
-	// printf("%s\n", line);
+void write_latency (void)
+{
+	FILE *lf;
 
-	token = strtok(line, t);
-	i = 0;
-	while (token)
+	lf = fopen(latency_file, "w");
+	if (lf == NULL)
 	{
-		gradient[i] = atof(token);
-		token = strtok(NULL, t);
-		if (i < channels - 1)
-		{
-			i++;
-		}
-		else
-		{
-			break;
-		}
+		fprintf (stderr, "vehicleMon: Can't write %s: %s\n", latency_file, strerror (errno));
+		return;
 	}
+	latency_report(&latency, lf);
+	fclose(lf);
+	printf("latency: written to %s\n", latency_file);
+}
 
-   //
-   // offset
-   //
-	line = malloc(line_length * sizeof(char));
-
-	fgets(line, line_length, fp);
-	fgets(line, line_length, fp);
+/*
+ * check_alarms:
+ *  Run the alarm rules over the channels with a new sample, at the time
+ *  the samples were taken.  A trip takes its snapshot straight away; the
+ *  trips and clears are then passed to the main thread for show_alarms(),
+ *  and the new samples and alarm states published on the live value board.
+ *********************************************************************************
+ */
 
-	token = strtok(line, t);
-	i = 0;
-	while (token)
+static void check_alarms (unsigned long fresh, int64_t at)
+{
+	struct alarm_event ev[max_channels];
+	struct alarm_note note;
+	int64_t now;
+	unsigned long before = alarms.tripped;
+	int i, n;
+
+	n = alarm_eval(&alarms, modified_voltage, fresh, at, ev);
+	now = clock_ns(CLOCK_MONOTONIC);
+	for (i = 0; i < channels; i++)
 	{
-		offset[i] = atof(token);
-		token = strtok(NULL, t);
-		if (i < channels - 1)
+		if (fresh & (1UL << i))
 		{
-			i++;
+			latency_add(&latency, LATENCY_ALARM, i, now - calibrated_ns[i]);
 		}
-		else
+		if ((fresh | (before ^ alarms.tripped)) & (1UL << i))
 		{
-			break;
+			liveboard_publish(&board, i, sampled_ns[i], latest_code[i], true_voltage[i],
+					modified_voltage[i], (alarms.tripped >> i) & 1);
 		}
 	}
 
-	//
-	// max
-	//
-	line = malloc(line_length * sizeof(char));
-
-	fgets(line, line_length, fp);
-	fgets(line, line_length, fp);
-
-	token = strtok(line, t);
-	i = 0;
-	while (token)
+	for (i = 0; i < n; i++)
 	{
-		max[i] = atof(token);
-		token = strtok(NULL, t);
-		if (i < channels - 1)
+		if (ev[i].change == ALARM_TRIP)
 		{
-			i++;
+			snapshot_trigger(&snapshot, ev[i].channel);
 		}
-		else
+		if (on_alarm)
 		{
-			break;
+			on_alarm(&ev[i]);
 		}
+		note.event = ev[i];
+		note.requested_ns = requested_ns[ev[i].channel];
+		note.decided_ns = now;
+		ring_push(&alarm_ring, &note);	// if full, show_alarms() catches up from alarms.tripped
+	}
+	if (n > 0)
+	{
+		evloop_wake(&events);
 	}
+}
 
-   //
-   //min
-   //
-	line = malloc(line_length * sizeof(char));
+/*
+ * show_alarms:
+ *  Take in the alarm changes and show them.  A new trip sounds at once
+ *  unless its channel sounded for a trip in the last alarm_sound_ns; the
+ *  sound is otherwise repeated every alarm_sound_ns while an alarm is on,
+ *  and the alarm form shown or left every alarm_form_ns, so a channel
+ *  flickering across its limit can neither flood the display link nor
+ *  flip the forms about.  The form goes back once every alarm has cleared.
+ *  If the alarm ring overflowed, the alarm state is taken from the alarm
+ *  engine instead, as changes are missing.
+ *
+ *  @return: when it next needs calling, or 0 if only for a new change.
+ *********************************************************************************
+ */
 
-	fgets(line, line_length, fp);
-	fgets(line, line_length, fp);
+static int64_t show_alarms (int64_t now)
+{
+	struct alarm_note note;
+	int i, on, temp_form, lowest = -1, timed = -1, fresh = 0;
+	int64_t next = 0, held = 0;
+	unsigned long dropped, tripped;
 
-	token = strtok(line, t);
-	i = 0;
-	while (token)
+	while (ring_pop(&alarm_ring, &note) == 0)
 	{
-		min[i] = atof(token);
-		token = strtok(NULL, t);
-		if (i < channels - 1)
-		{
-			i++;
-		}
-		else
-		{
-			break;
-		}
+		i = note.event.channel;
+		alarm_activated[i] = note.event.change == ALARM_TRIP;
+		trip_requested[i] = alarm_activated[i] ? note.requested_ns : 0;
+		trip_decided[i] = note.decided_ns;
 	}
 
-   //
-   // reference voltage 1
-   //
-	line = malloc(line_length * sizeof(char));
-
-	fgets(line, line_length, fp);
-	fgets(line, line_length, fp);
-
-	token = strtok(line, t);
-	i = 0;
-	while (token)
+	// the ring only fills while sample_lock is held, so under it the ring
+	// and alarms.tripped agree
+	dropped = atomic_load(&alarm_ring.dropped);
+	if (dropped != alarm_dropped)
 	{
-		ref_volt_1[i] = atof(token);
-		token = strtok(NULL, t);
-		if (i < channels - 1)
-		{
-			i++;
-		}
-		else
+		pthread_mutex_lock(&sample_lock);
+		while (ring_pop(&alarm_ring, &note) == 0)
+			;
+		tripped = alarms.tripped;
+		dropped = atomic_load(&alarm_ring.dropped);
+		pthread_mutex_unlock(&sample_lock);
+
+		fprintf (stderr, "vehicleMon: %lu alarm changes dropped, catching up\n", dropped - alarm_dropped);
+		alarm_dropped = dropped;
+		for (i = 0; i < channels; i++)
 		{
-			break;
+			on = (tripped >> i) & 1;
+			if (on != alarm_activated[i])
+			{
+				alarm_activated[i] = on;
+				trip_requested[i] = alarm_activated[i] ? now : 0;
+				trip_decided[i] = now;
+			}
 		}
 	}
 
-   //
-   // reference voltage 2
-   //
-	line = malloc(line_length * sizeof(char));
-
-	fgets(line, line_length, fp);
-	fgets(line, line_length, fp);
-
-	token = strtok(line, t);
-	i = 0;
-	while (token)
+	for (i = channels - 1; i >= 0; i--)
 	{
-		ref_volt_2[i] = atof(token);
-		token = strtok(NULL, t);
-		if (i < channels - 1)
+		if (alarm_activated[i])
 		{
-			i++;
+			lowest = i;
 		}
-		else
+		if (trip_requested[i])
 		{
-			break;
+			timed = i;
+			if (now - trip_sound_at[i] >= alarm_sound_ns)
+			{
+				fresh = 1;
+			}
+			else if (held == 0 || trip_sound_at[i] + alarm_sound_ns < held)
+			{
+				held = trip_sound_at[i] + alarm_sound_ns;
+			}
 		}
 	}
 
-   //
-   // alarm goes off if this max is reached
-   //
-	line = malloc(line_length * sizeof(char));
-
-	fgets(line, line_length, fp);
-	fgets(line, line_length, fp);
+	if (current_form != ALARM)
+	{
+		alarm_form_shown = 0;
+	}
 
-	token = strtok(line, t);
-	i = 0;
-	while (token)
+	if (lowest >= 0)
 	{
-		alarm_max[i] = atof(token);
-		token = strtok(NULL, t);
-		if (i < channels - 1)
+		if (fresh || now - alarm_sound_at >= alarm_sound_ns)
 		{
-			i++;
+			// the lowest channel in alarm picks the sound, which is timed
+			// from the conversion of the lowest new trip, if there is one.
+			// Channels past the display share the last channel's sound
+			genieq_obj_from(&genie_q, GENIEQ_URGENT, GENIE_OBJ_SOUND, 0,
+					display_channels - (lowest < display_channels ? lowest : display_channels - 1),
+					timed, timed >= 0 ? trip_requested[timed] : 0);
+			alarm_sound_at = now;
+			for (i = 0; i < channels; i++)
+			{
+				if (trip_requested[i])
+				{
+					latency_add(&latency, LATENCY_NOTIFY, i, now - trip_decided[i]);
+					trip_requested[i] = 0;
+					trip_sound_at[i] = now;
+				}
+			}
+			held = 0;
 		}
-		else
+		next = alarm_sound_at + alarm_sound_ns;
+		if (held && held < next)
 		{
-			break;
+			next = held;
 		}
-	}
-
-   //
-   // alarm goes off if below this minimum
-   //
-	line = malloc(line_length * sizeof(char));
 
-	fgets(line, line_length, fp);
-	fgets(line, line_length, fp);
-
-	token = strtok(line, t);
-	i = 0;
-	while (token)
-	{
-		alarm_min[i] = atof(token);
-		token = strtok(NULL, t);
-		if (i < channels - 1)
-		{
-			i++;
-		}
-		else
+		if (current_form != ALARM)
 		{
-			break;
+			if (now - alarm_form_at >= alarm_form_ns)
+			{
+				genieq_obj(&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, ALARM, 0);
+				updateForm(ALARM);
+				alarm_form_at = now;
+				alarm_form_shown = 1;
+			}
+			else if (alarm_form_at + alarm_form_ns < next)
+			{
+				next = alarm_form_at + alarm_form_ns;
+			}
 		}
 	}
-
-   //
-   // armed (true/false)
-   //
-	line = malloc(line_length * sizeof(char));
-
-	fgets(line, line_length, fp);
-	fgets(line, line_length, fp);
-
-	token = strtok(line, t);
-	i = 0;
-	while (token)
+	else if (alarm_form_shown)
 	{
-		armed[i] = atof(token);
-		token = strtok(NULL, t);
-		if (i < channels - 1)
+		if (now - alarm_form_at >= alarm_form_ns)
 		{
-			i++;
+			genieq_obj(&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, previous_form, 0);
+			temp_form = current_form;
+			current_form = previous_form;
+			previous_form = temp_form;
+			alarm_form_at = now;
+			alarm_form_shown = 0;
 		}
 		else
 		{
-			break;
+			next = alarm_form_at + alarm_form_ns;
 		}
 	}
-
-   //
-   // volume
-   //
-	line = malloc(line_length * sizeof(char));
-
-	fgets(line, line_length, fp);
-	fgets(line, line_length, fp);
-
-    volume = atoi(line);
-    printf("volume: %d\n", volume);
-
-    // volume
-	genieWriteObj(GENIE_OBJ_SOUND, 1, volume);
-
-	fclose(fp);
-	return 0;
+	return next;
 }
 
 /*
- * adc_read_loop:
- *  Read adc values within a separate thread.
+ * render_loop:
+ *  Show the samples queued by the read thread, at the render thread's own
+ *  pace so a slow display never holds up sampling.  Writes go through the
+ *  render layer, which drops those that would not change the screen or
+ *  would take more than serial_budget bytes per second.  The scopes get the
+ *  points their min/max columns have finished, as many as the budget
+ *  allows each frame, and start again empty when their window is changed.
  *********************************************************************************
  */
 
-static void *adc_read_loop (void *data)
+static void *render_loop (void *data)
 {
-	int j;
-	struct sched_param sched;
-	int pri = 10;
-	int temp_form;
-
-	// Set to a real-time priority
-	//  (only works if root, ignored otherwise)
-
-	memset (&sched, 0, sizeof(sched));
-
-	if (pri > sched_get_priority_max (SCHED_RR))
-		pri = sched_get_priority_max (SCHED_RR);
+	struct sample sample;
+	struct timespec next;
+	int shown_form = -1;
+	int shown_window = 0;
+	const int *points;
+	int i;
 
-	sched.sched_priority = pri;
-	sched_setscheduler (0, SCHED_RR, &sched);
+	render_init(&render, &genie_q, serial_budget, widget_interval_ns);
 
-	// sleep(1);
+	clock_gettime(CLOCK_MONOTONIC, &next);
 	for (;;)
 	{
-		for (j = 0; j < 8; j++)
+		// a new form starts with its widgets in their initial state
+		if (current_form != shown_form)
 		{
-			// here we obtain the true voltage from the adc and convert it to
-			true_voltage[j] = getadc(j + 1);
-			modified_voltage[j] = gradient[j] * true_voltage[j] + offset[j];
-			// printf ("Channel: %d  = %2.4fV\n", j + 1, modified_voltage[j]);
+			render_invalidate(&render);
+			shown_form = current_form;
+		}
 
-			if (alarm_max[j] > alarm_min[j])
+		if (scope_window != shown_window)
+		{
+			shown_window = scope_window;
+			for (i = 0; i < 2; i++)
 			{
-				if (modified_voltage[j] > alarm_max[j] || modified_voltage[j] < alarm_min[j])
-				{
-					if (armed[j])
-					{
-						alarm_activated[j] = 1;
-						// genieWriteObj(GENIE_OBJ_SOUND, 0, j + 2);
-						genieWriteObj(GENIE_OBJ_SOUND, 0, 8 - j);
-						if (current_form != ALARM)
-						{
-							genieWriteObj(GENIE_OBJ_FORM, ALARM, 0);
-							updateForm(ALARM);
-						}
-					}
-				}
-				else
-				{
-					if (alarm_activated[j])
-					{
-						alarm_activated[j] = 0;
-						if (current_form == ALARM)
-						{
-							genieWriteObj(GENIE_OBJ_FORM, previous_form, 0);
-							temp_form = current_form;
-							current_form = previous_form;
-							previous_form = temp_form;
-						}
-					}
-				}
+				scope_init(&scopes[i], 4, scope_columns, shown_window * 1000000000LL);
 			}
-			else
-			{
-				if (modified_voltage[j] < alarm_max[j] || modified_voltage[j] > alarm_min[j])
-				{
-					if (armed[j])
-					{
+		}
 
-						genieWriteObj(GENIE_OBJ_SOUND, 0, 8 - j);
-						alarm_activated[j] = 1;
-						if (current_form != ALARM)
-						{
-							genieWriteObj(GENIE_OBJ_FORM, ALARM, 0);
-							updateForm(ALARM);
-						}
-					} 
-				} 
-				else
-				{
-					if (alarm_activated[j])
-					{
-						alarm_activated[j] = 0;
-						if (current_form == ALARM)
-						{
-							genieWriteObj(GENIE_OBJ_FORM, previous_form, 0);
-							temp_form = current_form;
-							current_form = previous_form;
-							previous_form = temp_form;
-						}
-					}
-				}
+		while (ring_pop(&sample_ring, &sample) == 0)
+		{
+			updateDisplay(sample.modified_voltage, sample.channel, sample.requested_ns,
+					(int64_t)sample.when.tv_sec * 1000000000LL + sample.when.tv_nsec);
+		}
+
+		for (i = 0; i < 2; i++)
+		{
+			while (scope_peek(&scopes[i], &points) && render_scope(&render, i, points, 4))
+			{
+				scope_pop(&scopes[i]);
 			}
+		}
 
-			updateDisplay(modified_voltage[j], j);
-			
-			// genieWriteObj(GENIE_OBJ_SCOPE, j < 4 ? 0 : 1, (int)(true_voltage[j]*25 + 50));
+		next.tv_nsec += render_period_ns;
+		if (next.tv_nsec >= 1000000000L)
+		{
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
 		}
-		// printf("\n");
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
 	}
 
 	return (void *)NULL;
 }
 
+
 /*
  * handleGenieEvent:
  *  Take a reply off the display and call the appropriate handler for it.
@@ -661,6 +1519,35 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 		}
 		break;
 
+	case SCOPE:
+		puts("SCOPE");
+
+		// switch the scopes between 10 s and 60 s across
+		if (reply->object == GENIE_OBJ_WINBUTTON && reply->index == BUT_SCOPE_WINDOW)
+		{
+			scope_window = scope_window == 10 ? 60 : 10;
+			printf("scope window: %d s\n", scope_window);
+			save_to_file();
+		}
+
+		// capture the channel selected on the calibrate form, or channel 1
+		if (reply->object == GENIE_OBJ_WINBUTTON && reply->index == BUT_CAPTURE)
+		{
+			if (capture_channel >= 0)
+			{
+				capture_channel = -1;
+			}
+			else if (capture_writing)
+			{
+				printf("capture: still writing %s\n", capture_file);
+			}
+			else
+			{
+				capture_channel = current_slider >= 0 ? current_slider : 0;
+			}
+		}
+		break;
+
 	case CALIBRATE:
 		puts("CALIBRATE");
 
@@ -669,30 +1556,30 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 			switch (reply->index)
 			{
 			case BUT_GRAD:
-				genieWriteObj (GENIE_OBJ_FORM, NUMPAD, 0);
+				genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, NUMPAD, 0);
 				updateForm(NUMPAD);
 				last_edit_button = BUT_GRAD;
 				break;
 			case BUT_OFFS:
-				genieWriteObj (GENIE_OBJ_FORM, NUMPAD, 0);
+				genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, NUMPAD, 0);
 				updateForm(NUMPAD);
 				last_edit_button = BUT_OFFS;
 				break;
 				/*  				case BUT_AUTO:
-					genieWriteObj (GENIE_OBJ_FORM, AUTO, 0);
+					genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, AUTO, 0);
 					updateForm(AUTO);
 				break;
 				case BUT_RESET:
-					genieWriteObj (GENIE_OBJ_FORM, CONFIRMATION, 0);
+					genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, CONFIRMATION, 0);
 					updateForm(CONFIRMATION);
 				break;*/
 			case BUT_MAX:
-				genieWriteObj (GENIE_OBJ_FORM, NUMPAD, 0);
+				genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, NUMPAD, 0);
 				updateForm(NUMPAD);
 				last_edit_button = BUT_MAX;
 				break;
 			case BUT_MIN:
-				genieWriteObj (GENIE_OBJ_FORM, NUMPAD, 0);
+				genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, NUMPAD, 0);
 				updateForm(NUMPAD);
 				last_edit_button = BUT_MIN;
 				break;
@@ -703,12 +1590,12 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 			switch(reply->index)
 			{
 			case BUT_4D_RESET:
-				genieWriteObj (GENIE_OBJ_FORM, CONFIRMATION, 0);
+				genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, CONFIRMATION, 0);
 				updateForm(CONFIRMATION);
 				break;
 			}
 
-			for (i = 0; i < channels; i++)
+			for (i = 0; i < display_channels; i++)
 			{
 				if (reply->index == slider[i])
 				{
@@ -757,26 +1644,31 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 				processKey('c');
 				if (previous_form == CALIBRATE)
 				{
-					genieWriteObj(GENIE_OBJ_FORM, CALIBRATE, 0);
+					genieq_obj(&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, CALIBRATE, 0);
 					updateForm(CALIBRATE);
 					updateGraphFormula();
 					updateRange();
 				}
 				else if (previous_form == AUTO)
 				{
-					genieWriteObj(GENIE_OBJ_FORM, AUTO, 0);
+					genieq_obj(&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, AUTO, 0);
 					updateForm(AUTO);	
 					updateAutoScreen();
 				}
 				else if (previous_form == SETUP_ALARM)
 				{
-					genieWriteObj(GENIE_OBJ_FORM, SETUP_ALARM, 0);
+					genieq_obj(&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, SETUP_ALARM, 0);
 					updateForm(SETUP_ALARM);	
 					updateAlarm();
 				}
+				else if (previous_form == SETTINGS)
+				{
+					genieq_obj(&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, SETTINGS, 0);
+					updateForm(SETTINGS);
+				}
 				else if (previous_form == ALARM)
 				{
-					genieWriteObj(GENIE_OBJ_FORM, pre_previous_form, 0);
+					genieq_obj(&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, pre_previous_form, 0);
 					updateForm(pre_previous_form);	
 					updateAlarm();
 					updateAutoScreen();
@@ -804,12 +1696,12 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 			switch (reply->index)
 			{
 			case BUT_CH_1:
-				genieWriteObj (GENIE_OBJ_FORM, NUMPAD, 0);
+				genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, NUMPAD, 0);
 				updateForm(NUMPAD);
 				last_edit_button = BUT_CH_1;
 				break;
 			case BUT_CH_2:
-				genieWriteObj (GENIE_OBJ_FORM, NUMPAD, 0);
+				genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, NUMPAD, 0);
 				updateForm(NUMPAD);
 				last_edit_button = BUT_CH_2;
 				break;
@@ -855,13 +1747,13 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 			if (reply->index == BUT_YES)
 			{
 				reset();
-				genieWriteObj(GENIE_OBJ_FORM, CALIBRATE, 0);
+				genieq_obj(&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, CALIBRATE, 0);
 				updateForm(CALIBRATE);
 				updateNumpadDisplay();
 			}
 			else if (reply->index == BUT_NO)
 			{
-				genieWriteObj(GENIE_OBJ_FORM, CALIBRATE, 0);
+				genieq_obj(&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, CALIBRATE, 0);
 				updateForm(CALIBRATE);
 				updateNumpadDisplay();
 			}
@@ -881,7 +1773,7 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 					if (rocker_values[i])
 					{
 						armed[i] = 1;
-						genieWriteObj(GENIE_OBJ_USER_LED, i, 1);
+						genieq_obj(&genie_q, GENIEQ_NORMAL, GENIE_OBJ_USER_LED, i, 1);
 					}
 				}
 				break;
@@ -892,19 +1784,19 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 					if (rocker_values[i])
 					{
 						armed[i] = 0;
-						genieWriteObj(GENIE_OBJ_USER_LED, i, 0);
+						genieq_obj(&genie_q, GENIEQ_NORMAL, GENIE_OBJ_USER_LED, i, 0);
 					}
 				}
 				break;
 
 			case BUT_ALARM_MIN:
-				genieWriteObj (GENIE_OBJ_FORM, NUMPAD, 0);
+				genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, NUMPAD, 0);
 				updateForm(NUMPAD);
 				last_edit_button = BUT_ALARM_MIN;
 				break;
 
 			case BUT_ALARM_MAX:
-				genieWriteObj (GENIE_OBJ_FORM, NUMPAD, 0);
+				genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, NUMPAD, 0);
 				updateForm(NUMPAD);
 				last_edit_button = BUT_ALARM_MAX;
 				break;
@@ -916,7 +1808,7 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 		}
 		else if (reply->object == GENIE_OBJ_4DBUTTON)
 		{
-			for (i = 0; i < channels; i++)
+			for (i = 0; i < display_channels; i++)
 			{
 				if (reply->index == rocker[i])
 				{
@@ -951,7 +1843,10 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 						{
 							armed[i] = 0;
 							alarm_activated[i] = 0;
-							genieWriteObj(GENIE_OBJ_USER_LED, i, 0);
+							if (i < display_channels)
+							{
+								genieq_obj(&genie_q, GENIEQ_NORMAL, GENIE_OBJ_USER_LED, i, 0);
+							}
 						}
 					}
 				}
@@ -961,10 +1856,13 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 					{
 						armed[i] = 0;
 						alarm_activated[i] = 0;
-						genieWriteObj(GENIE_OBJ_USER_LED, i, 0);
+						if (i < display_channels)
+						{
+							genieq_obj(&genie_q, GENIEQ_NORMAL, GENIE_OBJ_USER_LED, i, 0);
+						}
 					}
 				}
-				genieWriteObj(GENIE_OBJ_FORM, previous_form, 0);
+				genieq_obj(&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, previous_form, 0);
 				// updateForm(previous_form);
 				temp_form = current_form;
 				current_form = previous_form;
@@ -985,13 +1883,28 @@ void handleGenieEvent (struct genieReplyStruct *reply)
 		    	if (reply->index == BUT_REBOOT)
 		    	{
 		    	    puts("System going down for reboot now!");
+		    	    if (confstore_sync (&config) < 0)
+		    	    {
+		    	        fprintf (stderr, "vehicleMon: Settings not saved to %s: %s\n", data_file, strerror (errno));
+		    	    }
 		    	    system("sudo reboot");
 		    	}
 		    	if (reply->index == BUT_SHUTDOWN)
 		    	{
 		    	    puts("System going down for shutdown now!");
+		    	    if (confstore_sync (&config) < 0)
+		    	    {
+		    	        fprintf (stderr, "vehicleMon: Settings not saved to %s: %s\n", data_file, strerror (errno));
+		    	    }
 		    	    system("sudo halt");
 		    	}
+		    	// resolution and gain apply to the channels selected on the calibrate form
+		    	if (reply->index == BUT_RESOLUTION || reply->index == BUT_GAIN)
+		    	{
+		    	    genieq_obj (&genie_q, GENIEQ_URGENT, GENIE_OBJ_FORM, NUMPAD, 0);
+		    	    updateForm(NUMPAD);
+		    	    last_edit_button = reply->index;
+		    	}
 		    }
 	    break;
 	}
@@ -1163,6 +2076,32 @@ void processKey (int key)
 					}
 				}
 				break;
+			case BUT_RESOLUTION:
+				for (i = 0; i < channels; i++)
+				{
+					if (slider_values[i])
+					{
+						resolution[i] = (int)numberDouble;
+						if (setMode(i) < 0)
+						{
+							sprintf(numberString, "ERROR");
+						}
+					}
+				}
+				break;
+			case BUT_GAIN:
+				for (i = 0; i < channels; i++)
+				{
+					if (slider_values[i])
+					{
+						gain[i] = (int)numberDouble;
+						if (setMode(i) < 0)
+						{
+							sprintf(numberString, "ERROR");
+						}
+					}
+				}
+				break;
 			}
 			save_to_file();
 		}
@@ -1185,11 +2124,11 @@ void processKey (int key)
 
 /*
  * updateDisplay:
- *  Do just that.
+ *  Do just that, for a sample taken at at_ns.
  *********************************************************************************
  */
 
-void updateDisplay (double val, int index)
+void updateDisplay (double val, int index, int64_t origin_ns, int64_t at_ns)
 {
 	char buf[32];
 
@@ -1197,14 +2136,22 @@ void updateDisplay (double val, int index)
 	double graph_gradient;
 	double graph_offset;
 
+	// only the first channels have widgets, the rest are logged and alarmed
+	if (index >= display_channels)
+	{
+		return;
+	}
+
 	graph_gradient = 100 / (max[index] - min[index]);
 	graph_offset = 100 - graph_gradient * max[index];
 	output = graph_gradient * val + graph_offset;
 
-	sprintf(buf, "%.10lf V", val);
-	genieWriteStr(index, buf);
+	// 4 decimals is all the string widget has room for
+	sprintf(buf, "%.4lf V", val);
+	render_str(&render, index, buf, index, origin_ns);
 
-	genieWriteObj(GENIE_OBJ_SCOPE, index < 4 ? 0 : 1, (int)(output));
+	// the scope is written from render_loop, a point for each of its traces at once
+	scope_add(&scopes[index < 4 ? 0 : 1], index % 4, at_ns, (int)(output));
 	// if (index == 0)
 	// { 
 	//   printf("%d: %lf  grad: %lf, offs: %lf\n", index, output, graph_gradient, graph_offset);
@@ -1236,7 +2183,7 @@ void updateNumpadDisplay (void)
 		// printf ("%s\n", buf);
 	}
 
-	genieWriteStr (17, buf);  // Text box number 17
+	genieq_str (&genie_q, GENIEQ_NORMAL, 17, buf);  // Text box number 17
 }
 
 /*
@@ -1264,7 +2211,7 @@ void updateGraphFormula (void)
 		}
 	}
 
-	genieWriteStr (16, buf);  // Text box number 16
+	genieq_str (&genie_q, GENIEQ_NORMAL, 16, buf);  // Text box number 16
 }
 
 /*
@@ -1292,7 +2239,7 @@ void updateRange (void)
 		}
 	}
 
-	genieWriteStr (21, buf);  // Text box number 16
+	genieq_str (&genie_q, GENIEQ_NORMAL, 21, buf);  // Text box number 16
 }
 
 
@@ -1327,8 +2274,8 @@ void updateAutoScreen (void)
 		}
 	}
 
-	genieWriteStr (19, buf_1);  // Text box number 19
-	genieWriteStr (20, buf_2);  // Text box number 20
+	genieq_str (&genie_q, GENIEQ_NORMAL, 19, buf_1);  // Text box number 19
+	genieq_str (&genie_q, GENIEQ_NORMAL, 20, buf_2);  // Text box number 20
 }
 
 /*
@@ -1348,13 +2295,13 @@ void updateAlarm (void)
 	}
 	else
 	{
-		for (i = 0; i < channels; i++)
+		for (i = 0; i < display_channels; i++)
 		{
 			sprintf (buf, "%lf V", alarm_min[i]);
-			genieWriteStr (i + 33, buf);
+			genieq_str (&genie_q, GENIEQ_NORMAL, i + 33, buf);
 
 			sprintf (buf, "%lf V", alarm_max[i]);
-			genieWriteStr (i + 42, buf);
+			genieq_str (&genie_q, GENIEQ_NORMAL, i + 42, buf);
 		}
 
 	}
@@ -1409,7 +2356,7 @@ void reset(void)
 {
 	int i;
 
-	for (i = 0; i < 8; i++)
+	for (i = 0; i < channels; i++)
 	{
 		gradient[i] = 1;
 		offset[i] = 0;
@@ -1422,90 +2369,65 @@ void reset(void)
 	save_to_file();
 }
 
-void reset_alarm_min_max(void)
+/*
+ * setMode:
+ *  Pass a channel's resolution and gain to its read thread, which applies
+ *  them before its next conversion, falling back to the default mode if
+ *  either is not supported.
+ *
+ *  @return: 0 if the mode was taken or -1 if the default was used.
+ *********************************************************************************
+ */
+
+int setMode(int i)
 {
-	int i;
+	__u8 config;
+	float multiplier;
+	int ret = 0;
 
-	for (i = 0; i < 8; i++)
+	if (adc_config(1, resolution[i], gain[i], &config, &multiplier) < 0)
 	{
-		alarm_max[i] = 5;
-		alarm_min[i] = -5;
+		resolution[i] = ADC_DEFAULT_BITS;
+		gain[i] = ADC_DEFAULT_GAIN;
+		ret = -1;
 	}
 
-	save_to_file();
+	pthread_mutex_lock(&sample_lock);
+	pending_bits[i] = resolution[i];
+	pending_gain[i] = gain[i];
+	mode_pending |= 1UL << i;
+	pthread_mutex_unlock(&sample_lock);
+	return ret;
 }
 
-void save_to_file(void)
+void reset_alarm_min_max(void)
 {
 	int i;
-	char *line;
-	fp = fopen(data_file, "w");
-
-	fprintf(fp, "gradient:\n");
-
-	for (i = 0; i < channels; i++)
-	{
-		fprintf(fp, "%lf,", gradient[i]);
-	}
-
-	fprintf(fp, "\noffset:\n");
-
-	for (i = 0; i < channels; i++)
-	{
-		fprintf(fp, "%lf,", offset[i]);
-	}
-
-	fprintf(fp, "\nmax:\n");
-
-	for (i = 0; i < channels; i++)
-	{
-		fprintf(fp, "%lf,", max[i]);
-	}
-
-	fprintf(fp, "\nmin:\n");
 
 	for (i = 0; i < channels; i++)
 	{
-		fprintf(fp, "%lf,", min[i]);
-	}
-
-	fprintf(fp, "\nref_volt_1:\n");
-
-	for (i = 0; i < channels; i++)
-	{
-		fprintf(fp, "%lf,", ref_volt_1[i]);
-	}
-
-	fprintf(fp, "\nref_volt_2:\n");
-
-	for (i = 0; i < channels; i++)
-	{
-		fprintf(fp, "%lf,", ref_volt_2[i]);
-	}
-
-	fprintf(fp, "\nalarm_max:\n");
-
-	for (i = 0; i < channels; i++)
-	{
-		fprintf(fp, "%lf,", alarm_max[i]);
-	}
-
-	fprintf(fp, "\nalarm_min:\n");
-
-	for (i = 0; i < channels; i++)
-	{
-		fprintf(fp, "%lf,", alarm_min[i]);
+		alarm_max[i] = 5;
+		alarm_min[i] = -5;
 	}
 
-	fprintf(fp, "\narmed:\n");
+	save_to_file();
+}
 
-	for (i = 0; i < channels; i++)
-	{
-		fprintf(fp, "%lf,", armed[i]);
-	}
+/*
+ * save_to_file:
+ *  Hand the settings to the config store.  Returns at once; the file is
+ *  written in the background once the edits stop.
+ *********************************************************************************
+ */
 
-	fprintf(fp, "\nvolume:\n");
-    fprintf(fp, "%d", volume);
+void save_to_file(void)
+{
+	char *text;
+	size_t length;
 
+	fp = open_memstream(&text, &length);
+	confstore_format(fp, settings, settings_count, channels);
 	fclose(fp);
+	confstore_update(&config, text, length);
+	free(text);
 }